@@ -25,11 +25,14 @@
 #include <vector>
 #include <sstream>
 #include <sys/resource.h>
+#include <sys/wait.h>
 #include <iomanip>
 
 #include "Analyzer.h"
 #include "CallGraph.h"
 #include "Config.h"
+#include "Loader.h"
+#include "Server.h"
 
 using namespace llvm;
 
@@ -51,6 +54,53 @@ cl::opt<std::string> BCListFile(
 	"bc-list", cl::desc("Specify the file that contains the list of bitcode files"),
 	cl::init(""));
 
+cl::opt<unsigned> LoadJobs(
+	"load-jobs",
+	cl::desc("Number of threads for parsing input modules (0: all cores)"),
+	cl::init(1));
+cl::alias LoadJobsShort(
+	"j", cl::desc("Alias for -load-jobs"), cl::aliasopt(LoadJobs));
+
+cl::opt<unsigned> AnalysisJobs(
+	"analysis-jobs",
+	cl::desc("Number of threads for the analysis passes (0: all cores)"),
+	cl::init(1));
+
+cl::opt<std::string> IRCacheDir(
+	"ir-cache-dir",
+	cl::desc("Directory for caching textual IR inputs as bitcode"),
+	cl::init(""));
+
+cl::opt<std::string> SummaryCacheDir(
+	"summary-cache-dir",
+	cl::desc("Directory for caching per-module analysis summaries"),
+	cl::init(""));
+
+cl::opt<unsigned> StreamWindow(
+	"stream-window",
+	cl::desc("Only extract module summaries, keeping at most this many \
+		modules in memory (0: off); needs -summaries-only, as the \
+		analysis keeps all modules in memory. With -shards, the window \
+		of each worker"),
+	cl::init(0));
+
+cl::opt<bool> SummariesOnly(
+	"summaries-only",
+	cl::desc("Exit after extracting the summaries with -stream-window \
+		or -shards"),
+	cl::init(false));
+
+cl::opt<unsigned> Shards(
+	"shards",
+	cl::desc("Extract module summaries in this many worker processes \
+		before the analysis (0: off)"),
+	cl::init(0));
+
+cl::opt<std::string> ServeSocket(
+	"serve",
+	cl::desc("After the analysis, answer queries on this Unix socket"),
+	cl::init(""));
+
 cl::opt<unsigned> VerboseLevel(
 	"verbose-level", cl::desc("Print information at which verbose level"),
 	cl::init(0));
@@ -79,6 +129,7 @@ void IterativeModulePass::run(ModuleList &modules)
 
 	ModuleList::iterator i, e;
 	OP << "[" << ID << "] Initializing " << modules.size() << " modules\n";
+	beginStage("Initialization");
 	bool again = true;
 	while (again)
 	{
@@ -90,6 +141,7 @@ void IterativeModulePass::run(ModuleList &modules)
 		}
 	}
 	OP << "\n";
+	endStage();
 
 	unsigned iter = 0, changed = 1;
 	while (changed)
@@ -117,6 +169,7 @@ void IterativeModulePass::run(ModuleList &modules)
 	}
 
 	OP << "[" << ID << "] Postprocessing ...\n";
+	beginStage("Finalization");
 	again = true;
 	while (again)
 	{
@@ -127,36 +180,133 @@ void IterativeModulePass::run(ModuleList &modules)
 			again |= doFinalization(i->first);
 		}
 	}
+	endStage();
 
 	OP << "[" << ID << "] Done!\n\n";
 }
 
-void PrintResults(GlobalContext *GCtx)
+const FuncSet *CalleeSetPool::intern(const FuncSet &FS)
 {
 
-	int TotalTargets = 0;
-	for (auto IC : GCtx->IndirectCallInsts)
+	// Order-independent hash of the members
+	uint64_t Hash = FS.size();
+	for (Function *F : FS)
 	{
-		TotalTargets += GCtx->Callees[IC].size();
+		uint64_t H = (uint64_t)(uintptr_t)F * 0x9e3779b97f4a7c15ULL;
+		Hash += H ^ (H >> 29);
 	}
-	float AveIndirectTargets = 0.0;
-	if (GCtx->NumValidIndirectCalls)
-		AveIndirectTargets =
-			(float)GCtx->NumIndirectCallTargets / GCtx->IndirectCallInsts.size();
 
+	std::lock_guard<std::mutex> Guard(Lock);
+	auto &Bucket = Buckets[Hash];
+	for (const FuncSet *S : Bucket)
+	{
+		if (S->size() != FS.size())
+			continue;
+		bool Same = true;
+		for (Function *F : FS)
+		{
+			if (!S->count(F))
+			{
+				Same = false;
+				break;
+			}
+		}
+		if (Same)
+			return S;
+	}
+
+	Sets.push_back(std::make_unique<FuncSet>(FS));
+	Bucket.push_back(Sets.back().get());
+	return Sets.back().get();
+}
+
+void CallGraphCSR::build(const ModuleList &Modules, const CalleeMap &Callees)
+{
+
+	DenseSet<Function *> Targets;
+	for (auto &CF : Callees)
+		Targets.insert(CF.second->begin(), CF.second->end());
+
+	auto addCallSite = [&](CallInst *CI) {
+		if (CallSiteIDs.insert(make_pair(CI, CallSites.size())).second)
+			CallSites.push_back(CI);
+	};
+	auto addFunc = [&](Function *F) {
+		if (FuncIDs.insert(make_pair(F, Funcs.size())).second)
+			Funcs.push_back(F);
+	};
+
+	// Number in module order, so that the call sites of a function
+	// and the functions of a module are adjacent
+	for (auto &MN : Modules)
+	{
+		for (Function &F : *MN.first)
+		{
+			if (Targets.count(&F))
+				addFunc(&F);
+			for (BasicBlock &BB : F)
+				for (Instruction &I : BB)
+					if (CallInst *CI = dyn_cast<CallInst>(&I))
+						if (Callees.count(CI))
+							addCallSite(CI);
+		}
+	}
+	for (auto &CF : Callees)
+	{
+		addCallSite(CF.first);
+		for (Function *F : *CF.second)
+			addFunc(F);
+	}
+
+	// Forward adjacency
+	CalleeBegin.reserve(CallSites.size() + 1);
+	CalleeBegin.push_back(0);
+	for (CallInst *CI : CallSites)
+	{
+		const FuncSet &FS = *Callees.find(CI)->second;
+		size_t Begin = CalleeIDs.size();
+		for (Function *F : FS)
+			CalleeIDs.push_back(FuncIDs[F]);
+		std::sort(CalleeIDs.begin() + Begin, CalleeIDs.end());
+		CalleeBegin.push_back(CalleeIDs.size());
+	}
+
+	// Reverse adjacency, with the callers of a function sorted
+	CallerBegin.assign(Funcs.size() + 1, 0);
+	for (unsigned FID : CalleeIDs)
+		++CallerBegin[FID + 1];
+	for (size_t i = 1; i < CallerBegin.size(); ++i)
+		CallerBegin[i] += CallerBegin[i - 1];
+	CallerIDs.resize(CalleeIDs.size());
+	vector<unsigned> Next(CallerBegin.begin(), CallerBegin.end() - 1);
+	for (unsigned CS = 0; CS < CallSites.size(); ++CS)
+		for (unsigned FID : callees(CS))
+			CallerIDs[Next[FID]++] = CS;
+}
+
+void PrintResults(GlobalContext *GCtx)
+{
+
+	CallGraphCSR &CG = GCtx->CG;
+	int NumIndirectCalls = 0;
 	int totalsize = 0;
-	for (auto &curEle : GCtx->Callees)
+	for (unsigned CS = 0; CS < CG.CallSites.size(); ++CS)
 	{
-		if (curEle.first->isIndirectCall())
+		if (CG.CallSites[CS]->isIndirectCall())
 		{
-			totalsize += curEle.second.size();
+			++NumIndirectCalls;
+			totalsize += CG.callees(CS).size();
 		}
 	}
+	float AveIndirectTargets = 0.0;
+	if (GCtx->NumValidIndirectCalls)
+		AveIndirectTargets =
+			(float)GCtx->NumIndirectCallTargets / NumIndirectCalls;
 	OP << "\n@@ Total number of final callees: " << totalsize << "\n";
 
 	OP << "############## Result Statistics ##############\n";
 	cout << "# Ave. Number of indirect-call targets: \t" << std::setprecision(5) << AveIndirectTargets << "\n";
-	OP << "# Number of indirect calls: \t\t\t" << GCtx->IndirectCallInsts.size() << "\n";
+	OP << "# Number of indirect calls: \t\t\t" << NumIndirectCalls << "\n";
 	OP << "# Number of indirect calls with targets: \t" << GCtx->NumValidIndirectCalls << "\n";
 	OP << "# Number of indirect-call targets: \t\t" << GCtx->NumIndirectCallTargets << "\n";
 	OP << "# Number of address-taken functions: \t\t" << GCtx->AddressTakenFuncs.size() << "\n";
@@ -166,6 +316,133 @@ void PrintResults(GlobalContext *GCtx)
 	OP << "# Number of first layer targets: \t\t" << GCtx->NumFirstLayerTargets << "\n";
 }
 
+// Load the given input modules in windows of Window modules and call
+// Fn on each; a module and its context are released right after Fn
+// returns
+static void StreamModules(const vector<size_t> &Inputs, unsigned Window,
+		function_ref<void(Module *, const std::string &)> Fn)
+{
+
+	for (size_t Begin = 0; Begin < Inputs.size(); Begin += Window)
+	{
+		size_t N = std::min<size_t>(Window, Inputs.size() - Begin);
+		vector<std::unique_ptr<Module>> Loaded(N);
+		parallelFor(LoadJobs, N, [&](size_t i) {
+			LLVMContext *LLVMCtx = new LLVMContext();
+			SMDiagnostic Err;
+			Loaded[i] = loadIRFile(InputFilenames[Inputs[Begin + i]], Err,
+					*LLVMCtx, IRCacheDir);
+			if (!Loaded[i])
+				delete LLVMCtx;
+		});
+
+		for (size_t i = 0; i < N; ++i)
+		{
+			if (!Loaded[i])
+				continue;
+			Fn(Loaded[i].get(), InputFilenames[Inputs[Begin + i]]);
+			LLVMContext *LLVMCtx = &Loaded[i]->getContext();
+			Loaded[i].reset();
+			delete LLVMCtx;
+			invalidateTypeHashCache();
+		}
+	}
+}
+
+// The struct names of all modules are needed for type hashing, so
+// they are collected before any summary is extracted
+static void CollectStructNames(const vector<size_t> &Inputs, unsigned Window)
+{
+
+	OP << "Collecting struct names of " << Inputs.size() << " module(s)\n";
+	StreamModules(Inputs, Window, [&](Module *M, const std::string &) {
+		AddElementsStructNames(M);
+	});
+}
+
+// Write the summaries of the given modules while keeping only a
+// window of them in memory
+static unsigned ExtractSummaries(const vector<size_t> &Inputs, unsigned Window)
+{
+
+	GlobalContext StreamCtx;
+	CallGraphPass CGPass(&StreamCtx);
+	unsigned NumSaved = 0;
+	StreamModules(Inputs, Window, [&](Module *M, const std::string &Name) {
+		// Only one module is in the context at a time
+		StreamCtx.ModuleMaps[M] = Name;
+		StreamCtx.ModuleIDs[M] = 0;
+		if (CGPass.extractSummary(M))
+			++NumSaved;
+		StreamCtx.ModuleMaps.erase(M);
+		StreamCtx.ModuleIDs.erase(M);
+	});
+	return NumSaved;
+}
+
+static void StreamSummaries(unsigned Window)
+{
+
+	vector<size_t> Inputs(InputFilenames.size());
+	for (size_t i = 0; i < Inputs.size(); ++i)
+		Inputs[i] = i;
+
+	CollectStructNames(Inputs, Window);
+	unsigned NumSaved = ExtractSummaries(Inputs, Window);
+	OP << "Summaries available for " << NumSaved << " module(s)\n";
+}
+
+// Extract the summaries in Shards worker processes. A failing worker
+// only loses its summaries; the main analysis then initializes the
+// affected modules from their IR
+static void ShardSummaries(unsigned Shards, unsigned Window)
+{
+
+	vector<size_t> Inputs(InputFilenames.size());
+	for (size_t i = 0; i < Inputs.size(); ++i)
+		Inputs[i] = i;
+
+	// Workers inherit the struct names through fork()
+	CollectStructNames(Inputs, Window);
+
+	vector<pid_t> Workers;
+	for (unsigned Shard = 0; Shard < Shards; ++Shard)
+	{
+		// Round-robin assignment spreads large modules over shards
+		vector<size_t> ShardInputs;
+		for (size_t i = Shard; i < InputFilenames.size(); i += Shards)
+			ShardInputs.push_back(i);
+
+		pid_t Pid = fork();
+		if (Pid == 0)
+		{
+			unsigned NumSaved = ExtractSummaries(ShardInputs, Window);
+			OP << "[Shard " << Shard << "] Summaries available for "
+			   << NumSaved << " / " << ShardInputs.size() << " module(s)\n";
+			OP.flush();
+			_exit(NumSaved == ShardInputs.size() ? 0 : 1);
+		}
+		if (Pid < 0)
+		{
+			OP << "Cannot fork the worker of shard " << Shard << "\n";
+			continue;
+		}
+		Workers.push_back(Pid);
+	}
+
+	unsigned NumFailed = 0;
+	for (pid_t Pid : Workers)
+	{
+		int Status;
+		if (waitpid(Pid, &Status, 0) < 0 ||
+			!WIFEXITED(Status) || WEXITSTATUS(Status) != 0)
+			++NumFailed;
+	}
+	if (NumFailed)
+		OP << NumFailed << " shard worker(s) failed; their modules are "
+		   << "analyzed from IR\n";
+}
+
 int main(int argc, char **argv)
 {
 
@@ -176,7 +453,6 @@ int main(int argc, char **argv)
 	llvm_shutdown_obj Y; // Call llvm_shutdown() on exit.
 
 	cl::ParseCommandLineOptions(argc, argv, "global analysis\n");
-	SMDiagnostic Err;
 
 	SRC_ROOT = SrcRoot;
 
@@ -199,45 +475,123 @@ int main(int argc, char **argv)
 		}
 	}
 
+	ENABLE_MLTA = MLTA;
+	ANALYSIS_JOBS = AnalysisJobs;
+	ENABLE_TYDM = TyPM;
+	MAX_PHASE_CG = PHASE;
+	if (!ENABLE_TYDM)
+		MAX_PHASE_CG = 1;
+
 	// Loading modules
 	OP << "Total " << InputFilenames.size() << " file(s)\n";
 
-	for (unsigned i = 0; i < InputFilenames.size(); ++i)
+	if (!IRCacheDir.empty())
 	{
+		if (std::error_code EC = sys::fs::create_directories(IRCacheDir))
+		{
+			OP << "Cannot create IR cache directory " << IRCacheDir
+			   << ": " << EC.message() << "\n";
+			IRCacheDir = "";
+		}
+	}
+
+	if (!SummaryCacheDir.empty())
+	{
+		if (std::error_code EC = sys::fs::create_directories(SummaryCacheDir))
+			OP << "Cannot create summary cache directory " << SummaryCacheDir
+			   << ": " << EC.message() << "\n";
+		else
+			SUMMARY_CACHE_DIR = SummaryCacheDir;
+	}
+
+	if (StreamWindow || Shards)
+	{
+		if (SUMMARY_CACHE_DIR.empty())
+		{
+			errs() << "Error: -stream-window and -shards require "
+				   << "-summary-cache-dir\n";
+			return 1;
+		}
+		// Extracting the summaries in windows does not bound the peak
+		// of the analysis, which loads all modules afterwards
+		if (StreamWindow && !Shards && !SummariesOnly)
+		{
+			errs() << "Error: -stream-window requires -summaries-only; "
+				   << "run the analysis separately with the summaries\n";
+			return 1;
+		}
+		beginStage("Summary extraction");
+		if (Shards)
+			ShardSummaries(Shards, std::max(1u, (unsigned)StreamWindow));
+		else
+			StreamSummaries(StreamWindow);
+		endStage();
+		if (SummariesOnly)
+		{
+			printStageUsage();
+			return 0;
+		}
+	}
 
+	// Each module gets its own context, so modules can be parsed
+	// concurrently; they are still added in the input order to keep
+	// the results deterministic
+	beginStage("Loading");
+	vector<std::unique_ptr<Module>> LoadedModules(InputFilenames.size());
+	parallelFor(LoadJobs, InputFilenames.size(), [&](size_t i) {
 		LLVMContext *LLVMCtx = new LLVMContext();
-		std::unique_ptr<Module> M = parseIRFile(InputFilenames[i], Err, *LLVMCtx);
+		SMDiagnostic Err;
+		LoadedModules[i] = loadIRFile(InputFilenames[i], Err, *LLVMCtx,
+				IRCacheDir);
+		if (!LoadedModules[i])
+			delete LLVMCtx;
+	});
 
-		if (M == NULL)
+	for (unsigned i = 0; i < InputFilenames.size(); ++i)
+	{
+
+		if (LoadedModules[i] == NULL)
 		{
 			OP << argv[0] << ": error loading file '"
 			   << InputFilenames[i] << "'\n";
 			continue;
 		}
 
-		Module *Module = M.release();
+		Module *Module = LoadedModules[i].release();
 		StringRef MName = StringRef(strdup(InputFilenames[i].data()));
+		GlobalCtx.ModuleIDs[Module] = GlobalCtx.Modules.size();
 		GlobalCtx.Modules.push_back(std::make_pair(Module, MName));
 		GlobalCtx.ModuleMaps[Module] = InputFilenames[i];
 	}
+	endStage();
+
 	//
 	// Main workflow
 	//
 
 	// Build global callgraph.
 
-	ENABLE_MLTA = MLTA;
-	ENABLE_TYDM = TyPM;
-	MAX_PHASE_CG = PHASE;
-	if (!ENABLE_TYDM)
-		MAX_PHASE_CG = 1;
-
 	CallGraphPass CGPass(&GlobalCtx);
 	CGPass.run(GlobalCtx.Modules);
 	// CGPass.processResults();
 
+	// Freeze the call graph for the consumers below
+	beginStage("Freezing");
+	GlobalCtx.CG.build(GlobalCtx.Modules, GlobalCtx.Callees);
+	GlobalCtx.Callees.shrink_and_clear();
+	GlobalCtx.CalleeSets.clear();
+	endStage();
+
 	// Print final results
 	PrintResults(&GlobalCtx);
+	printStageUsage();
+
+	if (!ServeSocket.empty())
+	{
+		QueryServer Server(&GlobalCtx, &CGPass);
+		if (!Server.run(ServeSocket))
+			return 1;
+	}
 
 	return 0;
 }
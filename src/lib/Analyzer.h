@@ -4,8 +4,11 @@
 #include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SparseBitVector.h>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
@@ -33,7 +36,61 @@ typedef std::unordered_map<llvm::Module*, llvm::StringRef> ModuleNameMap;
 typedef llvm::SmallPtrSet<llvm::Function*, 8> FuncSet;
 typedef llvm::SmallPtrSet<llvm::CallInst*, 8> CallInstSet;
 typedef DenseMap<Function*, CallInstSet> CallerMap;
-typedef DenseMap<CallInst *, FuncSet> CalleeMap;
+// Callee sets are interned in GlobalContext::CalleeSets
+typedef DenseMap<CallInst *, const FuncSet *> CalleeMap;
+// A set of modules by their IDs in GlobalContext
+typedef llvm::SparseBitVector<> ModuleSet;
+
+//
+// Hash-consed callee sets. Call sites with the same targets share one
+// immutable set, so equal sets have equal pointers. To change the
+// targets of a call site, intern a modified copy. Sets live as long
+// as the pool. intern() can be called from several threads.
+//
+class CalleeSetPool {
+
+	public:
+		const FuncSet *intern(const FuncSet &FS);
+		size_t size() const { return Sets.size(); }
+		void clear() { Buckets.clear(); Sets.clear(); }
+
+	private:
+		// Interned sets by content hash
+		DenseMap<uint64_t, SmallVector<const FuncSet *, 1>> Buckets;
+		std::vector<std::unique_ptr<FuncSet>> Sets;
+		std::mutex Lock;
+};
+
+//
+// The final call graph in compressed sparse row form. Call sites and
+// functions get dense IDs in module order. The callees of call site
+// C are CalleeIDs[CalleeBegin[C] .. CalleeBegin[C + 1]), and the call
+// sites that may call function F are CallerIDs[CallerBegin[F] ..
+// CallerBegin[F + 1]).
+//
+struct CallGraphCSR {
+
+	vector<CallInst *> CallSites;
+	vector<Function *> Funcs;
+	DenseMap<CallInst *, unsigned> CallSiteIDs;
+	DenseMap<Function *, unsigned> FuncIDs;
+
+	vector<unsigned> CalleeBegin;
+	vector<unsigned> CalleeIDs;
+	vector<unsigned> CallerBegin;
+	vector<unsigned> CallerIDs;
+
+	void build(const ModuleList &Modules, const CalleeMap &Callees);
+
+	ArrayRef<unsigned> callees(unsigned CS) const {
+		return makeArrayRef(CalleeIDs).slice(CalleeBegin[CS],
+				CalleeBegin[CS + 1] - CalleeBegin[CS]);
+	}
+	ArrayRef<unsigned> callers(unsigned F) const {
+		return makeArrayRef(CallerIDs).slice(CallerBegin[F],
+				CallerBegin[F + 1] - CallerBegin[F]);
+	}
+};
 
 struct GlobalContext {
 
@@ -52,13 +109,16 @@ struct GlobalContext {
 	DenseMap<size_t, GlobalVariable *>Globals;
 	
 	// Map global function GUID (uint64_t) to its actual function with body.
-	map<uint64_t, Function*> GlobalFuncMap;
+	DenseMap<uint64_t, Function*> GlobalFuncMap;
 
 	// Functions whose addresses are taken.
 	FuncSet AddressTakenFuncs;
 
 	// Map a callsite to all potential callee functions.
 	CalleeMap Callees;
+	CalleeSetPool CalleeSets;
+	// Callees frozen after the analysis; Callees is then released
+	CallGraphCSR CG;
 
 	// Map a function to all potential caller instructions.
 #ifdef MAP_CALLER_TO_CALLEE
@@ -67,13 +127,15 @@ struct GlobalContext {
 
 	// Map function signature to functions
 	DenseMap<size_t, FuncSet>sigFuncsMap;
-
-	// Indirect call instructions.
-	std::vector<CallInst *>IndirectCallInsts;
+	// Dense IDs of the functions in sigFuncsMap, for FuncBitSet
+	DenseMap<Function *, unsigned> FuncIDs;
+	std::vector<Function *> FuncsByID;
 
 	// Modules.
 	ModuleList Modules;
 	ModuleNameMap ModuleMaps;
+	// Dense module IDs: the index of each module in Modules
+	DenseMap<Module *, unsigned> ModuleIDs;
 	std::set<std::string> InvolvedModules;
 
 };
@@ -26,6 +26,7 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/Support/FileSystem.h"
 
 #include <map>
 #include <vector>
@@ -62,37 +63,42 @@ void CallGraphPass::PhaseMLTA(Function *F)
 		if (CallInst *CI = dyn_cast<CallInst>(&*i))
 		{
 
-			CallSet.insert(CI);
-
-			FuncSet *FS = &Ctx->Callees[CI];
+			const FuncSet *FS;
 			Value *CV = CI->getCalledOperand();
 			Function *CF = dyn_cast<Function>(CV);
 
 			// Indirect call
 			if (CI->isIndirectCall())
 			{
+				size_t CIH = callHash(CI);
+				CallSites.add(CI, moduleID(F->getParent()), CIH);
 
 				// Multi-layer type matching
 				if (ENABLE_MLTA > 1)
 				{
-					findCalleesWithMLTA(CI, *FS);
-				}
-				// Fuzzy type matching
-				else if (ENABLE_MLTA == 0)
-				{
-					size_t CIH = callHash(CI);
-					if (MatchedICallTypeMap.find(CIH) != MatchedICallTypeMap.end())
-						*FS = MatchedICallTypeMap[CIH];
+					auto It = PreparedCallees.find(CI);
+					if (It != PreparedCallees.end())
+						FS = It->second;
 					else
 					{
-						findCalleesWithType(CI, *FS);
-						MatchedICallTypeMap[CIH] = *FS;
+						FuncSet Targets;
+						MLTAStats Stats;
+						findCalleesWithMLTA(CI, Targets, Stats);
+						Stats.addTo(Ctx);
+						FS = Ctx->CalleeSets.intern(Targets);
 					}
 				}
-				// One-layer type matching
+				// Fuzzy or one-layer type matching
 				else
 				{
-					*FS = Ctx->sigFuncsMap[callHash(CI)];
+					auto It = MatchedICallTypeMap.find(CIH);
+					if (It != MatchedICallTypeMap.end())
+						FS = It->second;
+					else
+					{
+						FS = findCalleesWithSig(CI, CIH);
+						MatchedICallTypeMap[CIH] = FS;
+					}
 				}
 
 #ifdef MAP_CALLER_TO_CALLEE
@@ -102,13 +108,8 @@ void CallGraphPass::PhaseMLTA(Function *F)
 				}
 #endif
 
-				// Save called values for future uses.
-				Ctx->IndirectCallInsts.push_back(CI);
-
-				ICallSet.insert(CI);
 				if (!FS->empty())
 				{
-					MatchedICallSet.insert(CI);
 					Ctx->NumIndirectCallTargets += FS->size();
 					Ctx->NumValidIndirectCalls++;
 				}
@@ -116,6 +117,9 @@ void CallGraphPass::PhaseMLTA(Function *F)
 			// Direct call
 			else
 			{
+				CallSites.add(CI, moduleID(F->getParent()), 0);
+
+				FuncSet Targets;
 				// not InlineAsm
 				if (CF)
 				{
@@ -125,11 +129,11 @@ void CallGraphPass::PhaseMLTA(Function *F)
 						// StringRef FName = CF->getName();
 						// if (FName.startswith("SyS_"))
 						//	FName = StringRef("sys_" + FName.str().substr(4));
-						if (Function *GF = Ctx->GlobalFuncMap[CF->getGUID()])
+						if (Function *GF = Ctx->GlobalFuncMap.lookup(CF->getGUID()))
 							CF = GF;
 					}
 
-					FS->insert(CF);
+					Targets.insert(CF);
 
 #ifdef MAP_CALLER_TO_CALLEE
 					Ctx->Callers[CF].insert(CI);
@@ -140,7 +144,9 @@ void CallGraphPass::PhaseMLTA(Function *F)
 				{
 					// TODO: handle InlineAsm functions
 				}
+				FS = Ctx->CalleeSets.intern(Targets);
 			}
+			Ctx->Callees[CI] = FS;
 #if 0
 			if (ENABLE_MLTA > 1) {
 				if (CI->isIndirectCall()) {
@@ -177,10 +183,118 @@ void CallGraphPass::PhaseMLTA(Function *F)
 	}
 }
 
-void CallGraphPass::PhaseTyPM(Function *F)
+// Targets of an indirect call with fuzzy (-mlta=0) or one-layer
+// (-mlta=1) type matching, which are cached by signature
+const FuncSet *CallGraphPass::findCalleesWithSig(CallInst *CI, size_t CIH)
 {
-	for (inst_iterator i = inst_begin(F), e = inst_end(F);
-		 i != e; ++i)
+	if (ENABLE_MLTA == 0)
+	{
+		FuncSet Targets;
+		findCalleesWithType(CI, Targets);
+		return Ctx->CalleeSets.intern(Targets);
+	}
+
+	auto It = Ctx->sigFuncsMap.find(CIH);
+	if (It == Ctx->sigFuncsMap.end())
+		return Ctx->CalleeSets.intern(FuncSet());
+	return Ctx->CalleeSets.intern(It->second);
+}
+
+// Resolve the indirect calls of all modules on ANALYSIS_JOBS threads
+// before phase 1 walks the modules, which then takes the results in
+// order. Matching by type is done once per signature with its first
+// call site, as phase 1 would do; MLTA resolves each call site with
+// counters per task.
+void CallGraphPass::prepareICallTargets()
+{
+	vector<CallInst *> ICalls;
+	for (auto &MN : Ctx->Modules)
+	{
+		for (Function &F : *MN.first)
+		{
+			if (F.isDeclaration() || F.isIntrinsic())
+				continue;
+			for (inst_iterator i = inst_begin(F), e = inst_end(F);
+				 i != e; ++i)
+			{
+				CallInst *CI = dyn_cast<CallInst>(&*i);
+				if (CI && CI->isIndirectCall())
+					ICalls.push_back(CI);
+			}
+		}
+	}
+
+	if (ENABLE_MLTA > 1)
+	{
+		const size_t TaskSize = 256;
+		size_t NumTasks = (ICalls.size() + TaskSize - 1) / TaskSize;
+		vector<const FuncSet *> Targets(ICalls.size());
+		vector<MLTAStats> Stats(NumTasks);
+		parallelFor(ANALYSIS_JOBS, NumTasks, [&](size_t t) {
+			size_t End = std::min(ICalls.size(), (t + 1) * TaskSize);
+			for (size_t i = t * TaskSize; i < End; ++i)
+			{
+				FuncSet FS;
+				findCalleesWithMLTA(ICalls[i], FS, Stats[t]);
+				Targets[i] = Ctx->CalleeSets.intern(FS);
+			}
+		});
+
+		for (size_t i = 0; i < ICalls.size(); ++i)
+			PreparedCallees[ICalls[i]] = Targets[i];
+		for (auto &S : Stats)
+			S.addTo(Ctx);
+	}
+	else
+	{
+		vector<pair<size_t, CallInst *>> Sigs;
+		DenseSet<size_t> Seen;
+		for (CallInst *CI : ICalls)
+		{
+			size_t CIH = callHash(CI);
+			if (Seen.insert(CIH).second && !MatchedICallTypeMap.count(CIH))
+				Sigs.push_back(make_pair(CIH, CI));
+		}
+
+		vector<const FuncSet *> Targets(Sigs.size());
+		parallelFor(ANALYSIS_JOBS, Sigs.size(), [&](size_t i) {
+			Targets[i] = findCalleesWithSig(Sigs[i].second, Sigs[i].first);
+		});
+
+		for (size_t i = 0; i < Sigs.size(); ++i)
+			MatchedICallTypeMap[Sigs[i].first] = Targets[i];
+	}
+}
+
+void CallGraphPass::PhaseTyPM(Module *M)
+{
+	unsigned MID = moduleID(M);
+	vector<FlowEdges> Flows(1);
+	PhaseTyPM(CallSites.ModuleBegin[MID], CallSites.ModuleBegin[MID + 1],
+			  Flows[0]);
+	mergeFlows(Flows);
+}
+
+// Parse the calls of all modules on ANALYSIS_JOBS threads before the
+// modules are walked; ranges of call sites get their own edges, which
+// are merged in call-site order as the walk would add them
+void CallGraphPass::prepareTypeFlows()
+{
+	const unsigned TaskSize = 256;
+	unsigned NumCallSites = CallSites.size();
+	size_t NumTasks = (NumCallSites + TaskSize - 1) / TaskSize;
+	vector<FlowEdges> Flows(NumTasks);
+	parallelFor(ANALYSIS_JOBS, NumTasks, [&](size_t t) {
+		unsigned Begin = t * TaskSize;
+		PhaseTyPM(Begin, std::min(NumCallSites, Begin + TaskSize), Flows[t]);
+	});
+	mergeFlows(Flows);
+}
+
+void CallGraphPass::PhaseTyPM(unsigned Begin, unsigned End,
+		FlowEdges &Flows)
+{
+	for (unsigned CS = Begin; CS < End; ++CS)
 	{
 
 		//
@@ -189,22 +303,20 @@ void CallGraphPass::PhaseTyPM(Function *F)
 
 		// Note: the following impl is not type-aware yet
 		// Collect data flows through functions calls
-		CallInst *CI = dyn_cast<CallInst>(&*i);
-		if (!CI)
-			continue;
+		CallInst *CI = CallSites.Insts[CS];
 
-		if (CI->arg_empty())
+		if (!CallSites.NumArgs[CS])
 			continue;
 
 		// Indirect call
-		if (CI->isIndirectCall())
+		if (CallSites.IsIndirect[CS])
 		{
 
-			for (auto CF : Ctx->Callees[CI])
+			for (auto CF : *CallSites.callees(CS))
 			{
 				// Need to use the actual function with body here
 				if (CF->isDeclaration())
-					CF = Ctx->GlobalFuncMap[CF->getGUID()];
+					CF = Ctx->GlobalFuncMap.lookup(CF->getGUID());
 				if (!CF)
 				{
 					continue;
@@ -212,7 +324,7 @@ void CallGraphPass::PhaseTyPM(Function *F)
 				if (CF->doesNotAccessMemory())
 					continue;
 
-				parseTargetTypesInCalls(CI, CF);
+				parseTargetTypesInCalls(CI, CF, Flows);
 			}
 		}
 
@@ -221,7 +333,7 @@ void CallGraphPass::PhaseTyPM(Function *F)
 		{
 			// NOTE: Do not use getCalledFunction as it can only return
 			// function within the module
-			Value *CO = CI->getCalledOperand();
+			Value *CO = CallSites.CalledOperands[CS];
 			if (!CO)
 			{
 				continue;
@@ -236,7 +348,7 @@ void CallGraphPass::PhaseTyPM(Function *F)
 			// Need to use the actual function with body here
 			if (CF->isDeclaration())
 			{
-				CF = Ctx->GlobalFuncMap[CF->getGUID()];
+				CF = Ctx->GlobalFuncMap.lookup(CF->getGUID());
 				if (!CF)
 				{
 					// Have to skip it as the function body is not in
@@ -247,7 +359,7 @@ void CallGraphPass::PhaseTyPM(Function *F)
 			if (CF->doesNotAccessMemory())
 				continue;
 
-			parseTargetTypesInCalls(CI, CF);
+			parseTargetTypesInCalls(CI, CF, Flows);
 		}
 	}
 }
@@ -264,8 +376,6 @@ bool CallGraphPass::doInitialization(Module *M)
 	assert(Int8PtrTy[M]);
 	IntPtrTy[M] = DLMap[M]->getIntPtrType(M->getContext());
 
-	set<User *> CastSet;
-
 	//
 	// Do something at the begining
 	//
@@ -285,6 +395,9 @@ bool CallGraphPass::doInitialization(Module *M)
 				}
 			}
 		}
+
+		if (ANALYSIS_JOBS != 1)
+			prepareModuleFacts();
 	}
 
 	//
@@ -304,46 +417,30 @@ bool CallGraphPass::doInitialization(Module *M)
 
 			// Ctx->Globals[GV->getGUID()] = GV;
 
-			// Parse the initializer
+			// Parse the initializer. This follows external globals
+			// into other modules, so it is not part of the summary
 			set<Type *> TySet;
 			findTargetTypesInInitializer(GV, M, TySet);
-
-			typeConfineInInitializer(GV);
-
-			// Collect all casts in the global variable
-			findCastsInGV(GV, CastSet);
 		}
 	}
 
-	// Iterate functions and instructions
-	for (Function &F : *M)
-	{
+	//
+	// Collect the facts of the module, or load them from its summary
+	//
+	ModuleFacts MF;
+	if (!PreparedFacts.empty())
+		MF = std::move(PreparedFacts[moduleID(M)]);
+	else
+		getModuleFacts(*this, M, MF);
 
-		// Do not include LLVM intrinsic functions?
-		if (F.isIntrinsic())
-		{
-			continue;
-		}
+	applyModuleFacts(M, MF);
 
-		// Collect address-taken functions.
-		// NOTE: declaration functions can also have address taken
-		if (F.hasAddressTaken())
-		{
-			Ctx->AddressTakenFuncs.insert(&F);
-			size_t FuncHash = funcHash(&F, false);
-			Ctx->sigFuncsMap[FuncHash].insert(&F);
-			StringRef FName = F.getName();
-			// The following functions are not in the analysis scope
-			if (FName.startswith("__x64") ||
-				FName.startswith("__ia32") ||
-				FName.startswith("__do_sys"))
-			{
-				OutScopeFuncNames.insert(F.getName().str());
-			}
-		}
+	// Iterate functions
+	for (Function &F : *M)
+	{
 
 		// The following only considers actual functions with body
-		if (F.isDeclaration())
+		if (F.isIntrinsic() || F.isDeclaration())
 		{
 			continue;
 		}
@@ -354,30 +451,6 @@ bool CallGraphPass::doInitialization(Module *M)
 		{
 			Ctx->GlobalFuncMap[F.getGUID()] = &F;
 		}
-
-		//
-		// MLTA and TyPM
-		//
-		if (ENABLE_MLTA > 1)
-		{
-			typePropInFunction(&F);
-		}
-
-		collectAliasStructPtr(&F);
-		typeConfineInFunction(&F);
-
-		// Collect all casts in the function
-		findCastsInFunction(&F, CastSet);
-
-		// Handle casts
-		processCasts(CastSet, M);
-
-		// Collect all stores against fields of composite types in the
-		// function
-		findStoredTypeIdxInFunction(&F);
-
-		// Collection allocations of critical data structures
-		findTargetAllocInFunction(&F);
 	}
 
 	//
@@ -385,7 +458,6 @@ bool CallGraphPass::doInitialization(Module *M)
 	//
 	if (Ctx->Modules.size() == MIdx)
 	{
-
 		if (ENABLE_MLTA > 1)
 		{
 			// Map the declaration functions to actual ones
@@ -399,7 +471,7 @@ bool CallGraphPass::doInitialization(Module *M)
 					if (F->isDeclaration())
 					{
 						SF.second.erase(F);
-						if (Function *AF = Ctx->GlobalFuncMap[F->getGUID()])
+						if (Function *AF = Ctx->GlobalFuncMap.lookup(F->getGUID()))
 						{
 							SF.second.insert(AF);
 						}
@@ -416,7 +488,7 @@ bool CallGraphPass::doInitialization(Module *M)
 						if (F->isDeclaration())
 						{
 							IF.second.erase(F);
-							if (Function *AF = Ctx->GlobalFuncMap[F->getGUID()])
+							if (Function *AF = Ctx->GlobalFuncMap.lookup(F->getGUID()))
 							{
 								IF.second.insert(AF);
 							}
@@ -426,12 +498,186 @@ bool CallGraphPass::doInitialization(Module *M)
 			}
 		}
 
+		numberAddrTakenFuncs();
+
+		PreparedFacts.clear();
 		MIdx = 0;
 	}
 
 	return false;
 }
 
+// Collect the facts of M with Collector, or load them from the
+// summary of M
+void CallGraphPass::getModuleFacts(TyPM &Collector, Module *M,
+		ModuleFacts &MF)
+{
+	string SummaryPath;
+	uint64_t Digest = 0;
+	if (!SUMMARY_CACHE_DIR.empty())
+	{
+		Digest = moduleSummaryDigest(M, SummaryDigest);
+		SummaryPath = getSummaryPath(SUMMARY_CACHE_DIR,
+									 Ctx->ModuleMaps.at(M).str(), Digest);
+	}
+
+	if (!SummaryPath.empty() &&
+		loadModuleFacts(SummaryPath, M, moduleID(M), MF, Digest))
+	{
+		// Structures keyed by IR values are not in the summary
+		Collector.collectIRFacts(M, MF);
+	}
+	else
+	{
+		MF = ModuleFacts();
+		Collector.collectModuleFacts(M, MF);
+		if (!SummaryPath.empty())
+			saveModuleFacts(SummaryPath, M, MF, Digest);
+	}
+}
+
+// Each module gets its own collector, and every module has its own
+// context, so the facts of modules can be collected concurrently.
+// They are still applied in the module order by doInitialization(),
+// which keeps the results identical to a serial run.
+void CallGraphPass::prepareModuleFacts()
+{
+	// Int8PtrTy is shared by all collectors, so it is filled first
+	for (auto &MN : Ctx->Modules)
+	{
+		Module *M = MN.first;
+		Int8PtrTy[M] = Type::getInt8PtrTy(M->getContext());
+	}
+
+	PreparedFacts.resize(Ctx->Modules.size());
+	parallelFor(ANALYSIS_JOBS, Ctx->Modules.size(), [&](size_t i) {
+		Module *M = Ctx->Modules[i].first;
+		TyPM Collector(*this, M);
+		getModuleFacts(Collector, M, PreparedFacts[moduleID(M)]);
+	});
+}
+
+// Merge the facts of M into the pass
+void CallGraphPass::applyModuleFacts(Module *M, ModuleFacts &MF)
+{
+	for (auto &TF : MF.typeIdxFuncsMap)
+	{
+		for (auto &IF : TF.second)
+		{
+			typeIdxFuncsMap[TF.first][IF.first].insert(IF.second.begin(),
+													   IF.second.end());
+		}
+	}
+	for (auto &TP : MF.typeIdxPropMap)
+	{
+		for (auto &IP : TP.second)
+		{
+			typeIdxPropMap[TP.first][IP.first].insert(IP.second.begin(),
+													  IP.second.end());
+		}
+	}
+	typeEscapeSet.insert(MF.typeEscapeSet.begin(), MF.typeEscapeSet.end());
+	typeCapSet.insert(MF.typeCapSet.begin(), MF.typeCapSet.end());
+	StoredFuncs.insert(MF.StoredFuncs.begin(), MF.StoredFuncs.end());
+	for (auto &VF : MF.VTableFuncsMap)
+	{
+		VTableFuncsMap[VF.first].insert(VF.second.begin(), VF.second.end());
+	}
+
+	for (auto &MT : MF.storedTypeIdxMap)
+	{
+		for (auto &TI : MT.second)
+		{
+			storedTypeIdxMap[MT.first][TI.first] |= TI.second;
+		}
+	}
+	for (auto &MC : MF.CastFromMap)
+	{
+		for (auto &CT : MC.second)
+		{
+			CastFromMap[MC.first][CT.first].insert(CT.second.begin(),
+												   CT.second.end());
+		}
+	}
+	for (auto &MC : MF.CastToMap)
+	{
+		for (auto &CT : MC.second)
+		{
+			CastToMap[MC.first][CT.first].insert(CT.second.begin(),
+												 CT.second.end());
+		}
+	}
+	for (auto &TA : MF.TargetDataAllocModules)
+	{
+		TargetDataAllocModules[TA.first] |= TA.second;
+	}
+
+	for (auto &AF : MF.AddrTakenFuncs)
+	{
+		Function *F = AF.first;
+		Ctx->AddressTakenFuncs.insert(F);
+		Ctx->sigFuncsMap[AF.second].insert(F);
+		StringRef FName = F->getName();
+		// The following functions are not in the analysis scope
+		if (FName.startswith("__x64") ||
+			FName.startswith("__ia32") ||
+			FName.startswith("__do_sys"))
+		{
+			OutScopeFuncNames.insert(F->getName().str());
+		}
+	}
+
+	for (auto &AF : MF.AliasStructPtrMap)
+	{
+		AliasStructPtrMap[AF.first] = std::move(AF.second);
+	}
+	StoreInstSet.insert(MF.StoreInstSet.begin(), MF.StoreInstSet.end());
+
+	// Replay confinements that depend on other modules
+	for (auto &CC : MF.CallConfines)
+	{
+		if (Function *CF = Ctx->GlobalFuncMap.lookup(CC.CalleeGUID))
+			typeConfineInCallArg(CF, CC.ArgNo, CC.F);
+	}
+}
+
+bool CallGraphPass::extractSummary(Module *M)
+{
+	uint64_t Digest = moduleSummaryDigest(M, SummaryDigest);
+	string SummaryPath = getSummaryPath(SUMMARY_CACHE_DIR,
+										Ctx->ModuleMaps[M].str(), Digest);
+	if (SummaryPath.empty())
+		return false;
+	if (sys::fs::exists(SummaryPath))
+		return true;
+
+	DLMap[M] = &(M->getDataLayout());
+	Int8PtrTy[M] = Type::getInt8PtrTy(M->getContext());
+	IntPtrTy[M] = DLMap[M]->getIntPtrType(M->getContext());
+
+	ModuleFacts MF;
+	collectModuleFacts(M, MF);
+	bool Saved = saveModuleFacts(SummaryPath, M, MF, Digest);
+
+	// Drop all references to the IR of M; those among the facts go
+	// with MF
+	DLMap.erase(M);
+	Int8PtrTy.erase(M);
+	IntPtrTy.erase(M);
+
+	return Saved;
+}
+
+void CallGraphPass::getDependentModules(Module *M, Type *Ty,
+		ModuleSet &MSet)
+{
+	while (Ty->isPointerTy())
+		Ty = Ty->getPointerElementType();
+
+	getDependentModulesTy(typeHash(Ty), M, MSet);
+	MSet.set(moduleID(M));
+}
+
 bool CallGraphPass::doFinalization(Module *M)
 {
 
@@ -441,16 +687,28 @@ bool CallGraphPass::doFinalization(Module *M)
 		// Finally map declaration functions to actual functions
 		OP << "Mapping declaration functions to actual ones...\n";
 		Ctx->NumIndirectCallTargets = 0;
-		for (auto CI : CallSet)
+		// Each distinct set is mapped once
+		DenseMap<const FuncSet *, const FuncSet *> MappedSets;
+		for (unsigned CS = 0; CS < CallSites.size(); ++CS)
 		{
-			mapDeclToActualFuncs(Ctx->Callees[CI]);
+			CallInst *CI = CallSites.Insts[CS];
+			const FuncSet *&Callees = CallSites.callees(CS);
+			auto It = MappedSets.find(Callees);
+			if (It == MappedSets.end())
+			{
+				FuncSet Mapped = *Callees;
+				mapDeclToActualFuncs(Mapped);
+				It = MappedSets.insert(make_pair(Callees,
+							Ctx->CalleeSets.intern(Mapped))).first;
+			}
+			Callees = It->second;
 
-			if (CI->isIndirectCall())
+			if (CallSites.IsIndirect[CS])
 			{
-				Ctx->NumIndirectCallTargets += Ctx->Callees[CI].size();
-				dumpTargets(Ctx->Callees[CI], CI);
+				Ctx->NumIndirectCallTargets += Callees->size();
+				dumpTargets(*Callees, CI);
 #ifdef PRINT_ICALL_TARGET
-				printTargets(Ctx->Callees[CI], CI);
+				printTargets(*Callees, CI);
 #endif
 			}
 		}
@@ -468,6 +726,14 @@ bool CallGraphPass::doFinalization(Module *M)
 bool CallGraphPass::doModulePass(Module *M)
 {
 
+	if (MIdx == 0)
+	{
+		beginStage("Phase " + to_string(AnalysisPhase));
+		if (AnalysisPhase == 1 && ANALYSIS_JOBS != 1)
+			prepareICallTargets();
+		else if (AnalysisPhase >= 2 && ANALYSIS_JOBS != 1)
+			prepareTypeFlows();
+	}
 	++MIdx;
 
 	//
@@ -487,7 +753,7 @@ bool CallGraphPass::doModulePass(Module *M)
 
 #ifdef PARSE_VALUE_USES
 			// Parse its uses
-			set<Value *> Visited;
+			VisitedSet<Value *> Visited;
 			parseUsesOfGV(GV, GV, M, Visited);
 
 #else
@@ -521,12 +787,11 @@ bool CallGraphPass::doModulePass(Module *M)
 		// Use globals to connect modules
 		for (auto GMM : TypesToModuleGVMap)
 		{
-			for (auto DstM : GMM.second)
+			ModuleSet &FromMS = TypesFromModuleGVMap[GMM.first];
+			for (unsigned DstM : GMM.second)
 			{
-				size_t TyH = GMM.first.second;
-				moPropMap[make_pair(DstM, TyH)].insert(
-					TypesFromModuleGVMap[GMM.first].begin(),
-					TypesFromModuleGVMap[GMM.first].end());
+				TypeFP TyH = GMM.first.second;
+				moPropMap[make_pair(Ctx->Modules[DstM].first, TyH)] |= FromMS;
 			}
 		}
 #if 0
@@ -541,31 +806,37 @@ bool CallGraphPass::doModulePass(Module *M)
 	//
 	// Process functions
 	//
-	for (Module::iterator f = M->begin(), fe = M->end();
-		 f != fe; ++f)
+	if (AnalysisPhase == 1)
 	{
+		for (Module::iterator f = M->begin(), fe = M->end();
+			 f != fe; ++f)
+		{
 
-		Function *F = &*f;
+			Function *F = &*f;
 
-		if (F->isDeclaration() || F->isIntrinsic())
-			continue;
+			if (F->isDeclaration() || F->isIntrinsic())
+				continue;
 
-		// Phase 1: Multi-layer type analysis
-		if (AnalysisPhase == 1)
-		{
+			// Phase 1: Multi-layer type analysis
 			PhaseMLTA(F);
 		}
-		else
-		{
-			// Phase 2-to-n: Modular type analysis
-			// TODO: only iterate over indirect calls
-			PhaseTyPM(F);
-		}
+	}
+	else
+	{
+		// Phase 2-to-n: Modular type analysis over the call sites
+		// collected in phase 1; prepared already with several jobs
+		if (ANALYSIS_JOBS == 1)
+			PhaseTyPM(M);
 	}
 
 	// Analysis phase control
 	if (Ctx->Modules.size() == MIdx)
 	{
+		if (AnalysisPhase == 1)
+		{
+			CallSites.finish(Ctx->Callees, Ctx->Modules.size());
+			PreparedCallees.clear();
+		}
 
 		if (AnalysisPhase == 2)
 		{
@@ -580,22 +851,22 @@ bool CallGraphPass::doModulePass(Module *M)
 		if (AnalysisPhase >= 2)
 		{
 
-			ResolvedDepModulesMap.clear();
 			bool Iter = true;
 			// Merge the propagation maps
 			moPropMapAll.insert(moPropMap.begin(), moPropMap.end());
 			// Add map one by one to avoid overwritting
-			for (auto m : moPropMapV)
+			for (auto &m : moPropMapV)
 			{
-				moPropMapAll[m.first].insert(m.second.begin(), m.second.end());
+				moPropMapAll[m.first] |= m.second;
 			}
-
-			// TODO: multi-threading for better performance
+			resetDependenceClosures();
 
 			//
 			// Steps 2 and 3 of TyPM: Collecting depedent modules
 			// and resolving targets within  on dependent modules
 			//
+			endStage();
+			beginStage("Resolve (phase " + to_string(AnalysisPhase) + ")");
 #ifdef FUNCTION_AS_TARGET_TYPE
 			bool NextIter = resolveFunctionTargets();
 #else // struct as target type
@@ -605,16 +876,23 @@ bool CallGraphPass::doModulePass(Module *M)
 			if (!NextIter)
 			{
 				// Done with the iteration
+				endStage();
 				MIdx = 0;
 				return false;
 			}
 
-			// Reset the map when phase >= 2
+			// Reset the map when phase >= 2, which also releases the
+			// phase arenas; the last one is kept for dependence queries
 			moPropMapV.clear();
-			moPropMapAll.clear();
-			ParsedModuleTypeICallMap.clear();
-			ParsedModuleTypeDCallMap.clear();
+			if (AnalysisPhase < MAX_PHASE_CG)
+			{
+				moPropMapAll.clear();
+				resetDependenceClosures();
+			}
+			ParsedModuleTypeICallSet.clear();
+			ParsedModuleTypeDCallSet.clear();
 		}
+		endStage();
 
 		++AnalysisPhase;
 		MIdx = 0;
@@ -5,6 +5,7 @@
 #include "MLTA.h"
 #include "TyPM.h"
 #include "Config.h"
+#include "Summary.h"
 #include <time.h>
 
 class CallGraphPass : public virtual IterativeModulePass, public virtual TyPM
@@ -18,13 +19,36 @@ private:
 	// Index of the module
 	int MIdx;
 
+	// Digest of the configuration for summary files
+	uint64_t SummaryDigest;
+
+	// Facts of the modules by module ID, if prepared in parallel
+	vector<ModuleFacts> PreparedFacts;
+	// Targets of indirect calls with MLTA, if prepared in parallel
+	DenseMap<CallInst *, const FuncSet *> PreparedCallees;
+
 	//
 	// Methods
 	//
 
 	// Phases
 	void PhaseMLTA(Function *F);
-	void PhaseTyPM(Function *F);
+	void PhaseTyPM(Module *M);
+	// Cross-module flows through the call sites in [Begin, End)
+	void PhaseTyPM(unsigned Begin, unsigned End, FlowEdges &Flows);
+	// Get the flows of all modules on ANALYSIS_JOBS threads
+	void prepareTypeFlows();
+
+	// Resolving indirect calls of phase 1
+	const FuncSet *findCalleesWithSig(CallInst *CI, size_t CIH);
+	void prepareICallTargets();
+
+	// Per-module facts of the initialization
+	void getModuleFacts(TyPM &Collector, Module *M, ModuleFacts &MF);
+	void applyModuleFacts(Module *M, ModuleFacts &MF);
+	// Get the facts of all modules on ANALYSIS_JOBS threads before
+	// the first module is initialized
+	void prepareModuleFacts();
 
 public:
 	static int AnalysisPhase;
@@ -35,6 +59,7 @@ public:
 	{
 
 		LoadElementsStructNameMap(Ctx->Modules);
+		SummaryDigest = summaryConfigDigest(TTySet);
 		MIdx = 0;
 
 		time_t my_time = time(NULL);
@@ -46,6 +71,15 @@ public:
 	virtual bool doModulePass(llvm::Module *);
 
 	void processResults();
+
+	// Save the summary of M for later runs without keeping any of
+	// its facts, so that M can be released afterwards
+	bool extractSummary(llvm::Module *M);
+
+	// Modules whose values of type Ty can flow into M, as found by
+	// the last phase
+	void getDependentModules(llvm::Module *M, llvm::Type *Ty,
+			ModuleSet &MSet);
 };
 
 #endif
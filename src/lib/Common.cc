@@ -1,15 +1,100 @@
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <atomic>
+#include <iomanip>
 #include <fstream>
 #include <regex>
+#include <sstream>
 #include "Common.h"
 #include "Config.h"
 #include <llvm/Support/Path.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+//
+// Fingerprinting. Each lane is mixed with a bijective finalizer, so
+// distinct inputs of the same length only collide by chance.
+//
+class FPHasher {
+	public:
+		FPHasher(uint64_t Tag)
+			: Lo(0x736f6d6570736575ULL), Hi(0x646f72616e646f6dULL) {
+				add(Tag);
+			}
+
+		void add(uint64_t V) {
+			Lo = fmix(Lo ^ V);
+			Hi = fmix(Hi + V * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL);
+		}
+
+		void add(TypeFP FP) {
+			add(FP.Lo);
+			add(FP.Hi);
+		}
+
+		void add(StringRef Str) {
+			add(Str.size());
+			size_t i = 0;
+			for (; i + 8 <= Str.size(); i += 8)
+			{
+				uint64_t V;
+				memcpy(&V, Str.data() + i, 8);
+				add(V);
+			}
+			uint64_t V = 0;
+			memcpy(&V, Str.data() + i, Str.size() - i);
+			add(V);
+		}
+
+		TypeFP get() const { return {Lo, Hi}; }
+
+	private:
+		uint64_t Lo, Hi;
+
+		static uint64_t fmix(uint64_t X) {
+			X ^= X >> 33;
+			X *= 0xff51afd7ed558ccdULL;
+			X ^= X >> 33;
+			X *= 0xc4ceb9fe1a85ec53ULL;
+			X ^= X >> 33;
+			return X;
+		}
+};
+
+// Tags keeping the kinds of fingerprints apart
+enum FPTag {
+	FP_NamedStruct = 0x100,
+	FP_Type,
+	FP_Layout,
+	FP_Array,
+	FP_Idx,
+};
+
+raw_ostream &operator<<(raw_ostream &OS, const TypeFP &FP)
+{
+	OS << format_hex_no_prefix(FP.Hi, 16) << format_hex_no_prefix(FP.Lo, 16);
+	return OS;
+}
 
 // Map from struct elements to its name
-static map<string, set<StringRef>> elementsStructNameMap;
+static map<TypeFP, set<string>> elementsStructNameMap;
+
+// Literal structs are matched to named ones by the type IDs of
+// their elements
+static TypeFP structLayoutFP(StructType *STy)
+{
+	FPHasher H(FP_Layout);
+	H.add(STy->getNumElements());
+	for (auto Ty : STy->elements())
+		H.add(Ty->getTypeID());
+	return H.get();
+}
 
 bool trimPathSlash(string &path, int slash)
 {
@@ -202,7 +287,8 @@ DILocation *getSourceLocation(Instruction *I)
 }
 
 /// Print out source code information to facilitate manual analyses.
-void printSourceCodeInfo(Value *V, string Tag, string SrcRoot)
+void printSourceCodeInfo(Value *V, string Tag, string SrcRoot,
+		raw_ostream &OS)
 {
 	Instruction *I = dyn_cast<Instruction>(V);
 	if (!I)
@@ -221,14 +307,14 @@ void printSourceCodeInfo(Value *V, string Tag, string SrcRoot)
 
 	while (line[0] == ' ' || line[0] == '\t')
 		line.erase(line.begin());
-	OP << " ["
+	OS << " ["
 	   << "\033[34m" << Tag << "\033[0m" << "] "
 	   << FN
 	   << " +" << LineNo
 	   // #ifdef PRINT_SOURCE_LINE
 	   << " "
 	   << "\033[35m" << line << "\033[0m" << '\n';
-	OP << *I
+	OS << *I
 	   // #endif
 	   << "\n";
 }
@@ -413,32 +499,87 @@ void LoadElementsStructNameMap(
 
 	for (auto M : Modules)
 	{
-		for (auto STy : M.first->getIdentifiedStructTypes())
-		{
-			assert(STy->hasName());
-			if (STy->isOpaque())
-				continue;
+		AddElementsStructNames(M.first);
+	}
+}
 
-			string strSTy = structTyStr(STy);
-			elementsStructNameMap[strSTy].insert(STy->getName());
-		}
+// The names are copied, so the module can be released afterwards
+void AddElementsStructNames(Module *M)
+{
+
+	for (auto STy : M->getIdentifiedStructTypes())
+	{
+		assert(STy->hasName());
+		if (STy->isOpaque())
+			continue;
+
+		elementsStructNameMap[structLayoutFP(STy)].insert(STy->getName().str());
+	}
+	invalidateTypeHashCache();
+}
+
+uint64_t typeHashDigest(Module *M)
+{
+	// Only literal structs are hashed by the names in
+	// elementsStructNameMap, so only the entries for the layouts of
+	// the literal structs of M matter
+	TypeFinder Types;
+	Types.run(*M, false);
+	set<TypeFP> Layouts;
+	for (StructType *STy : Types)
+	{
+		if (STy->isLiteral())
+			Layouts.insert(structLayoutFP(STy));
+	}
+
+	hash<string> str_hash;
+	uint64_t Digest = str_hash("typeHashDigest");
+	for (auto &Layout : Layouts)
+	{
+		Digest = Digest * 31 + Layout.Lo;
+		Digest = Digest * 31 + Layout.Hi;
+		auto It = elementsStructNameMap.find(Layout);
+		if (It == elementsStructNameMap.end())
+			continue;
+		Digest = Digest * 31 + It->second.size();
+		for (auto &Name : It->second)
+			Digest = Digest * 31 + str_hash(Name);
 	}
+	return Digest;
+}
+
+// Hashes of types are cached per thread. Cached hashes go stale when
+// elementsStructNameMap changes or a context is released (its Type
+// pointers may be reused), which bumps the epoch.
+static std::atomic<unsigned> TypeHashEpoch(0);
+
+void invalidateTypeHashCache()
+{
+	++TypeHashEpoch;
+}
+
+static bool isIdentChar(char C)
+{
+	return isalnum((unsigned char)C) || C == '_';
 }
 
 void cleanString(string &str)
 {
 	// process string
-	// remove c++ class type added by compiler
+	// remove c++ class type added by compiler, i.e., the first
+	// "%class.<name>*" parameter and its comma
 	size_t pos = str.find("(%class.");
 	if (pos != string::npos)
 	{
-		// regex pattern1("\\(\\%class\\.[_A-Za-z0-9]+\\*,?");
-		regex pattern("^[_A-Za-z0-9]+\\*,?");
-		smatch match;
-		string str_sub = str.substr(pos + 8);
-		if (regex_search(str_sub, match, pattern))
+		size_t end = pos + 8;
+		while (end < str.size() && isIdentChar(str[end]))
+			++end;
+		if (end > pos + 8 && end < str.size() && str[end] == '*')
 		{
-			str.replace(pos + 1, 7 + match[0].length(), "");
+			++end;
+			if (end < str.size() && str[end] == ',')
+				++end;
+			str.erase(pos + 1, end - pos - 1);
 		}
 	}
 	string::iterator end_pos = remove(str.begin(), str.end(), ' ');
@@ -464,8 +605,42 @@ string funcTypeString(FunctionType *FTy)
 	return output;
 }
 
+// Hash of the cleaned signature string, cached per FunctionType
+// (sharing the invalidation epoch of the type hash cache)
+static size_t funcTypeHash(FunctionType *FTy)
+{
+	static thread_local DenseMap<FunctionType *, size_t> Cache;
+	static thread_local unsigned CacheEpoch = 0;
+
+	unsigned Epoch = TypeHashEpoch.load(std::memory_order_relaxed);
+	if (CacheEpoch != Epoch)
+	{
+		Cache.clear();
+		CacheEpoch = Epoch;
+	}
+
+	auto It = Cache.find(FTy);
+	if (It != Cache.end())
+		return It->second;
+
+	hash<string> str_hash;
+	string sig;
+	raw_string_ostream rso(sig);
+	FTy->print(rso);
+	string output = rso.str();
+	cleanString(output);
+
+	size_t Hash = str_hash(output);
+	Cache[FTy] = Hash;
+	return Hash;
+}
+
 size_t funcHash(Function *F, bool withName)
 {
+#ifndef HASH_SOURCE_INFO
+	if (!withName)
+		return funcTypeHash(F->getFunctionType());
+#endif
 
 	hash<string> str_hash;
 	string output;
@@ -509,112 +684,172 @@ size_t callHash(CallInst *CI)
 	//	if (CF)
 	//		return funcHash(CF);
 	// }
-	hash<string> str_hash;
-	string sig;
-	raw_string_ostream rso(sig);
-	FunctionType *FTy = CB->getFunctionType();
-	FTy->print(rso);
-	string strip_str = rso.str();
-	// string strip_str = funcTypeString(FTy);
-	cleanString(strip_str);
-
-	return str_hash(strip_str);
+	return funcTypeHash(CB->getFunctionType());
 }
 
-string structTyStr(StructType *STy)
+void structTypeHash(StructType *STy, set<TypeFP> &HSet)
 {
-	string ty_str;
-	string sig;
-	for (auto Ty : STy->elements())
-	{
-		ty_str += to_string(Ty->getTypeID());
-	}
-	return ty_str;
-}
-
-void structTypeHash(StructType *STy, set<size_t> &HSet)
-{
-	hash<string> str_hash;
-	string sig;
-	string ty_str;
 
 	// TODO: Use more but reliable information
 	// FIXME: A few cases may not even have a name
 	if (STy->hasName())
 	{
-		ty_str = STy->getName().str();
-		HSet.insert(str_hash(ty_str));
+		HSet.insert(structNameHash(STy->getName()));
 	}
 	else
 	{
-		string sstr = structTyStr(STy);
-		if (elementsStructNameMap.find(sstr) != elementsStructNameMap.end())
+		auto It = elementsStructNameMap.find(structLayoutFP(STy));
+		if (It != elementsStructNameMap.end())
 		{
-			for (auto SStr : elementsStructNameMap[sstr])
-			{
-				ty_str = SStr.str();
-				HSet.insert(str_hash(ty_str));
-			}
+			for (auto &SStr : It->second)
+				HSet.insert(structNameHash(SStr));
 		}
 	}
 }
 
-size_t typeHash(Type *Ty)
+TypeFP structNameHash(StringRef Name)
+{
+	FPHasher H(FP_NamedStruct);
+	H.add(Name);
+	return H.get();
+}
+
+// Structural fingerprint of a type, which is what its printed form
+// tells apart: named structs by name, everything else by structure
+static TypeFP typeFingerprint(Type *Ty);
+
+static TypeFP computeTypeFingerprint(Type *Ty)
+{
+	StructType *STy = dyn_cast<StructType>(Ty);
+	if (STy && STy->hasName())
+		return structNameHash(STy->getName());
+
+	FPHasher H(FP_Type);
+	H.add(Ty->getTypeID());
+	if (IntegerType *ITy = dyn_cast<IntegerType>(Ty))
+		H.add(ITy->getBitWidth());
+	else if (PointerType *PTy = dyn_cast<PointerType>(Ty))
+	{
+		H.add(PTy->getAddressSpace());
+		if (!PTy->isOpaque())
+			H.add(typeFingerprint(PTy->getPointerElementType()));
+	}
+	else if (STy)
+	{
+		H.add(STy->isPacked());
+		H.add(STy->isOpaque());
+		H.add(STy->getNumElements());
+		for (auto ETy : STy->elements())
+			H.add(typeFingerprint(ETy));
+	}
+	else if (ArrayType *ATy = dyn_cast<ArrayType>(Ty))
+	{
+		H.add(ATy->getNumElements());
+		H.add(typeFingerprint(ATy->getElementType()));
+	}
+	else if (VectorType *VTy = dyn_cast<VectorType>(Ty))
+	{
+		H.add(VTy->getElementCount().getKnownMinValue());
+		H.add(typeFingerprint(VTy->getElementType()));
+	}
+	else if (FunctionType *FTy = dyn_cast<FunctionType>(Ty))
+	{
+		H.add(FTy->isVarArg());
+		H.add(FTy->getNumParams());
+		H.add(typeFingerprint(FTy->getReturnType()));
+		for (auto PTy : FTy->params())
+			H.add(typeFingerprint(PTy));
+	}
+	return H.get();
+}
+
+static TypeFP computeTypeHash(Type *Ty)
 {
-	hash<string> str_hash;
-	string sig;
-	string ty_str;
 
 	if (StructType *STy = dyn_cast<StructType>(Ty))
 	{
 		// TODO: Use more but reliable information
 		// FIXME: A few cases may not even have a name
 		if (STy->hasName())
-		{
-			ty_str = STy->getName().str();
-		}
-		else
-		{
-			string sstr = structTyStr(STy);
-			if (elementsStructNameMap.find(sstr) != elementsStructNameMap.end())
-			{
-				ty_str = elementsStructNameMap[sstr].begin()->str();
-			}
-		}
+			return structNameHash(STy->getName());
+
+		// Literal structs take the first name with the same layout;
+		// all others share the hash of the empty name
+		auto It = elementsStructNameMap.find(structLayoutFP(STy));
+		if (It != elementsStructNameMap.end())
+			return structNameHash(*It->second.begin());
+		return structNameHash("");
 	}
 #ifdef SOUND_MODE
-	else if (ArrayType *ATy = dyn_cast<ArrayType>(Ty))
+	else if (isa<ArrayType>(Ty))
 	{
 
 		// Compiler sometimes fails recoginize size of array (compiler
 		// bug?), so let's just use the element type
 
-		// Ty = ATy->getElementType();
-		raw_string_ostream rso(sig);
-		Ty->print(rso);
-		ty_str = rso.str() + "[array]";
-		string::iterator end_pos = remove(ty_str.begin(), ty_str.end(), ' ');
-		ty_str.erase(end_pos, ty_str.end());
+		FPHasher H(FP_Array);
+		H.add(typeFingerprint(Ty));
+		return H.get();
 	}
 #endif
-	else
+	return typeFingerprint(Ty);
+}
+
+// Both fingerprints are cached per thread
+struct TypeHashCache {
+	DenseMap<Type *, TypeFP> Hashes;
+	DenseMap<Type *, TypeFP> Fingerprints;
+	unsigned Epoch = 0;
+};
+
+static TypeHashCache &getTypeHashCache()
+{
+	static thread_local TypeHashCache Cache;
+
+	unsigned Epoch = TypeHashEpoch.load(std::memory_order_relaxed);
+	if (Cache.Epoch != Epoch)
 	{
-		raw_string_ostream rso(sig);
-		Ty->print(rso);
-		ty_str = rso.str();
-		string::iterator end_pos = remove(ty_str.begin(), ty_str.end(), ' ');
-		ty_str.erase(end_pos, ty_str.end());
+		Cache.Hashes.clear();
+		Cache.Fingerprints.clear();
+		Cache.Epoch = Epoch;
 	}
-	return str_hash(ty_str);
+	return Cache;
 }
 
-size_t hashIdxHash(size_t Hs, int Idx)
+static TypeFP typeFingerprint(Type *Ty)
 {
-	hash<string> str_hash;
-	return Hs + str_hash(to_string(Idx));
+	TypeHashCache &Cache = getTypeHashCache();
+	auto It = Cache.Fingerprints.find(Ty);
+	if (It != Cache.Fingerprints.end())
+		return It->second;
+
+	// Named structs end the recursion, so cycles are not possible
+	TypeFP FP = computeTypeFingerprint(Ty);
+	Cache.Fingerprints[Ty] = FP;
+	return FP;
+}
+
+TypeFP typeHash(Type *Ty)
+{
+	TypeHashCache &Cache = getTypeHashCache();
+	auto It = Cache.Hashes.find(Ty);
+	if (It != Cache.Hashes.end())
+		return It->second;
+
+	TypeFP Hash = computeTypeHash(Ty);
+	Cache.Hashes[Ty] = Hash;
+	return Hash;
 }
 
-size_t typeIdxHash(Type *Ty, int Idx)
+TypeFP hashIdxHash(TypeFP Hs, int Idx)
+{
+	FPHasher H(FP_Idx);
+	H.add(Hs);
+	H.add((uint64_t)(int64_t)Idx);
+	return H.get();
+}
+
+TypeFP typeIdxHash(Type *Ty, int Idx)
 {
 	return hashIdxHash(typeHash(Ty), Idx);
 }
@@ -627,12 +862,6 @@ size_t strIntHash(string str, int i)
 	return str_hash(str.substr(0, pos) + to_string(i));
 }
 
-size_t moduleTypeHash(Module *M, size_t TyH)
-{
-	hash<string> str_hash;
-	return str_hash(M->getName().str() + to_string(TyH));
-}
-
 int64_t getGEPOffset(const Value *V, const DataLayout *DL)
 {
 
@@ -662,3 +891,183 @@ int64_t getGEPOffset(const Value *V, const DataLayout *DL)
 	offset += DL->getIndexedOffsetInType(ptrTy, indexOps);
 	return offset;
 }
+
+// The pool lives as long as the process, so the thread_local caches
+// of its threads (type hashes, walk pools) are kept between calls. It
+// is rebuilt only when a call asks for another number of jobs, i.e.,
+// once between loading and the analysis.
+static ThreadPool &getThreadPool(unsigned Jobs)
+{
+	static std::unique_ptr<ThreadPool> Pool;
+	static unsigned PoolJobs = 0;
+	static pid_t PoolPid = 0;
+
+	// A forked shard worker has none of the threads of the pool, so
+	// its copy can be neither used nor destroyed
+	if (Pool && PoolPid != getpid())
+		(void)Pool.release();
+	if (!Pool || PoolJobs != Jobs)
+	{
+		Pool = std::make_unique<ThreadPool>(hardware_concurrency(Jobs));
+		PoolJobs = Jobs;
+		PoolPid = getpid();
+	}
+	return *Pool;
+}
+
+void parallelFor(unsigned Jobs, size_t N, function_ref<void(size_t)> Fn)
+{
+	if (Jobs == 1 || N < 2)
+	{
+		for (size_t i = 0; i < N; ++i)
+			Fn(i);
+		return;
+	}
+
+	ThreadPool &Pool = getThreadPool(Jobs);
+	unsigned NumThreads = std::min<size_t>(Pool.getThreadCount(), N);
+
+	// Threads pull indices from a shared counter, so a few expensive
+	// items do not stall a statically assigned chunk
+	std::atomic<size_t> Next(0);
+	for (unsigned t = 0; t < NumThreads; ++t)
+	{
+		Pool.async([&]() {
+			for (size_t i = Next++; i < N; i = Next++)
+				Fn(i);
+		});
+	}
+	Pool.wait();
+}
+
+struct StageUsage {
+	string Name;
+	double Wall;
+	double User;
+	double Sys;
+	// Peak RSS of the process so far at the end of the stage, in KB
+	long MaxRSS;
+	long MajFlt;
+	long MinFlt;
+	// Usage of the child processes reaped during the stage, e.g., the
+	// shard workers of summary extraction. The peak is that of the
+	// largest child reaped so far.
+	double ChildUser;
+	double ChildSys;
+	long ChildMaxRSS;
+	long ChildMajFlt;
+	long ChildMinFlt;
+};
+
+static vector<StageUsage> Stages;
+static bool InStage = false;
+static std::chrono::steady_clock::time_point StageStart;
+static struct rusage StageRU;
+static struct rusage StageChildRU;
+
+static double tvSeconds(const struct timeval &TV)
+{
+	return TV.tv_sec + TV.tv_usec / 1e6;
+}
+
+void beginStage(const string &Name)
+{
+	if (InStage)
+		endStage();
+
+	StageUsage SU = {Name, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	Stages.push_back(SU);
+	InStage = true;
+	getrusage(RUSAGE_SELF, &StageRU);
+	getrusage(RUSAGE_CHILDREN, &StageChildRU);
+	StageStart = std::chrono::steady_clock::now();
+}
+
+void endStage()
+{
+	if (!InStage)
+		return;
+
+	auto End = std::chrono::steady_clock::now();
+	struct rusage RU, ChildRU;
+	getrusage(RUSAGE_SELF, &RU);
+	getrusage(RUSAGE_CHILDREN, &ChildRU);
+	InStage = false;
+
+	StageUsage &SU = Stages.back();
+	SU.Wall = std::chrono::duration<double>(End - StageStart).count();
+	SU.User = tvSeconds(RU.ru_utime) - tvSeconds(StageRU.ru_utime);
+	SU.Sys = tvSeconds(RU.ru_stime) - tvSeconds(StageRU.ru_stime);
+	SU.MaxRSS = RU.ru_maxrss;
+	SU.MajFlt = RU.ru_majflt - StageRU.ru_majflt;
+	SU.MinFlt = RU.ru_minflt - StageRU.ru_minflt;
+	SU.ChildUser = tvSeconds(ChildRU.ru_utime)
+		- tvSeconds(StageChildRU.ru_utime);
+	SU.ChildSys = tvSeconds(ChildRU.ru_stime)
+		- tvSeconds(StageChildRU.ru_stime);
+	SU.ChildMaxRSS = ChildRU.ru_maxrss;
+	SU.ChildMajFlt = ChildRU.ru_majflt - StageChildRU.ru_majflt;
+	SU.ChildMinFlt = ChildRU.ru_minflt - StageChildRU.ru_minflt;
+}
+
+static bool hasChildUsage(const StageUsage &SU)
+{
+	return SU.ChildUser > 0 || SU.ChildSys > 0 || SU.ChildMajFlt > 0
+		|| SU.ChildMinFlt > 0;
+}
+
+void printStageUsage()
+{
+	endStage();
+	if (Stages.empty())
+		return;
+
+	const string ChildSuffix = " (children)";
+	size_t NameWidth = 5;
+	for (auto &SU : Stages)
+		NameWidth = std::max(NameWidth, SU.Name.size()
+				+ (hasChildUsage(SU) ? ChildSuffix.size() : 0));
+
+	std::ostringstream OS;
+	OS << std::fixed << std::setprecision(2);
+	OS << "\n@@ Stage usage\n";
+	OS << std::left << std::setw(NameWidth) << "Stage" << std::right
+	   << std::setw(10) << "Wall(s)" << std::setw(10) << "User(s)"
+	   << std::setw(10) << "Sys(s)" << std::setw(12) << "PeakRSS(MB)"
+	   << std::setw(10) << "MajFlt" << std::setw(12) << "MinFlt" << "\n";
+
+	double Wall = 0, User = 0, Sys = 0;
+	long MaxRSS = 0, MajFlt = 0, MinFlt = 0;
+	auto Row = [&](const string &Name, double W, double U, double S,
+			long RSS, long Maj, long Min) {
+		OS << std::left << std::setw(NameWidth) << Name << std::right
+		   << std::setw(10) << W << std::setw(10) << U
+		   << std::setw(10) << S << std::setw(12) << RSS / 1024.0
+		   << std::setw(10) << Maj << std::setw(12) << Min << "\n";
+	};
+	for (auto &SU : Stages)
+	{
+		Row(SU.Name, SU.Wall, SU.User, SU.Sys, SU.MaxRSS, SU.MajFlt, SU.MinFlt);
+		Wall += SU.Wall;
+		User += SU.User;
+		Sys += SU.Sys;
+		MaxRSS = std::max(MaxRSS, SU.MaxRSS);
+		MajFlt += SU.MajFlt;
+		MinFlt += SU.MinFlt;
+		if (!hasChildUsage(SU))
+			continue;
+		// Wall time is already counted in the stage itself
+		Row(SU.Name + ChildSuffix, 0, SU.ChildUser, SU.ChildSys,
+				SU.ChildMaxRSS, SU.ChildMajFlt, SU.ChildMinFlt);
+		User += SU.ChildUser;
+		Sys += SU.ChildSys;
+		MaxRSS = std::max(MaxRSS, SU.ChildMaxRSS);
+		MajFlt += SU.ChildMajFlt;
+		MinFlt += SU.ChildMinFlt;
+	}
+	Row("Total", Wall, User, Sys, MaxRSS, MajFlt, MinFlt);
+	OS << "(PeakRSS: peak of the process so far; of the largest child "
+	   << "so far for children)\n";
+
+	OP << OS.str();
+}
@@ -2,6 +2,9 @@
 #define _COMMON_H_
 
 #include <llvm/IR/Module.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseMapInfo.h>
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/ADT/Triple.h>
 #include <llvm/Support/raw_ostream.h>
@@ -11,6 +14,7 @@
 #include <unistd.h>
 #include <bitset>
 #include <chrono>
+#include <mutex>
 
 
 #define Z3_ENABLED 0
@@ -62,6 +66,191 @@ using namespace std;
 
 extern cl::opt<unsigned> VerboseLevel;
 
+//
+// 128-bit type fingerprint. Named structs are identified by their
+// names and all other types by their structure, as in their printed
+// form, but no string is formatted to compute it.
+//
+struct TypeFP {
+	uint64_t Lo;
+	uint64_t Hi;
+
+	bool operator==(const TypeFP &O) const { return Lo == O.Lo && Hi == O.Hi; }
+	bool operator!=(const TypeFP &O) const { return !(*this == O); }
+	bool operator<(const TypeFP &O) const
+		{ return Hi < O.Hi || (Hi == O.Hi && Lo < O.Lo); }
+};
+
+raw_ostream &operator<<(raw_ostream &OS, const TypeFP &FP);
+
+namespace llvm {
+template <> struct DenseMapInfo<TypeFP> {
+	static inline TypeFP getEmptyKey() { return {~0ULL, ~0ULL}; }
+	static inline TypeFP getTombstoneKey() { return {~0ULL - 1, ~0ULL}; }
+	static unsigned getHashValue(const TypeFP &FP)
+		{ return (unsigned)(FP.Lo ^ (FP.Lo >> 32)); }
+	static bool isEqual(const TypeFP &L, const TypeFP &R) { return L == R; }
+};
+}
+
+//
+// Scratch state for graph walks. Each thread keeps pools of visited
+// marks and worklists that walks borrow and return, so that a walk
+// does not allocate once the pools are warm. Nested walks borrow
+// separate instances.
+//
+template <typename T>
+struct WalkPool {
+	static vector<std::unique_ptr<T>> &get() {
+		static thread_local vector<std::unique_ptr<T>> Pool;
+		return Pool;
+	}
+	static T *acquire() {
+		auto &Pool = get();
+		if (Pool.empty())
+			return new T();
+		T *Obj = Pool.back().release();
+		Pool.pop_back();
+		return Obj;
+	}
+	static void release(T *Obj) { get().emplace_back(Obj); }
+};
+
+//
+// Visited marks stamped with an epoch: clear() starts a new epoch
+// instead of erasing the marks. rollback() undoes the visits made
+// since mark(), for walks that try alternatives in turn.
+//
+template <typename T>
+class VisitedSet {
+
+	struct Marks {
+		DenseMap<T, unsigned> Stamps;
+		vector<T> Log;
+		unsigned Epoch = 1;
+	};
+
+	public:
+		VisitedSet() : M(WalkPool<Marks>::acquire()) { clear(); }
+		~VisitedSet() {
+			// Do not keep the marks of a huge walk around
+			if (M->Stamps.size() > (1u << 16))
+				M->Stamps.shrink_and_clear();
+			M->Log.clear();
+			WalkPool<Marks>::release(M);
+		}
+		VisitedSet(const VisitedSet &) = delete;
+		VisitedSet &operator=(const VisitedSet &) = delete;
+
+		// Returns false if V has been visited
+		bool insert(T V) {
+			unsigned &Stamp = M->Stamps[V];
+			if (Stamp == M->Epoch)
+				return false;
+			Stamp = M->Epoch;
+			M->Log.push_back(V);
+			return true;
+		}
+		bool count(T V) const {
+			auto It = M->Stamps.find(V);
+			return It != M->Stamps.end() && It->second == M->Epoch;
+		}
+		void clear() {
+			M->Log.clear();
+			if (++M->Epoch == 0) {
+				M->Stamps.clear();
+				M->Epoch = 1;
+			}
+		}
+		size_t mark() const { return M->Log.size(); }
+		void rollback(size_t Mark) {
+			while (M->Log.size() > Mark) {
+				M->Stamps[M->Log.back()] = 0;
+				M->Log.pop_back();
+			}
+		}
+
+	private:
+		Marks *M;
+};
+
+//
+// FIFO worklist on a pooled vector, in place of std::list
+//
+template <typename T>
+class Worklist {
+
+	public:
+		Worklist() : Items(WalkPool<vector<T>>::acquire()) {}
+		~Worklist() {
+			Items->clear();
+			WalkPool<vector<T>>::release(Items);
+		}
+		Worklist(const Worklist &) = delete;
+		Worklist &operator=(const Worklist &) = delete;
+
+		bool empty() const { return Head == Items->size(); }
+		void push_back(T V) { Items->push_back(V); }
+		T &front() { return (*Items)[Head]; }
+		void pop_front() {
+			if (++Head == Items->size()) {
+				Items->clear();
+				Head = 0;
+			}
+		}
+
+	private:
+		vector<T> *Items;
+		size_t Head = 0;
+};
+
+//
+// Map shared by threads, e.g., to memoize results. Keys are spread
+// over shards that are locked separately; values are copied out, as
+// other threads may insert into the shard meanwhile.
+//
+template <typename KeyT, typename ValueT>
+class ConcurrentMap {
+
+	static const unsigned NumShards = 64;
+
+	struct alignas(64) Shard {
+		std::mutex Lock;
+		DenseMap<KeyT, ValueT> Map;
+	};
+
+	public:
+		bool lookup(const KeyT &K, ValueT &V) {
+			Shard &S = shardOf(K);
+			std::lock_guard<std::mutex> Guard(S.Lock);
+			auto It = S.Map.find(K);
+			if (It == S.Map.end())
+				return false;
+			V = It->second;
+			return true;
+		}
+		// Keeps the value of K if it is already present
+		void insert(const KeyT &K, const ValueT &V) {
+			Shard &S = shardOf(K);
+			std::lock_guard<std::mutex> Guard(S.Lock);
+			S.Map.insert(std::make_pair(K, V));
+		}
+		void clear() {
+			for (Shard &S : Shards)
+				S.Map.clear();
+		}
+
+	private:
+		Shard Shards[NumShards];
+
+		// The shard takes the high bits of the mixed hash, as the
+		// map in the shard takes the low ones
+		Shard &shardOf(const KeyT &K) {
+			uint64_t H = DenseMapInfo<KeyT>::getHashValue(K);
+			return Shards[(H * 0x9e3779b97f4a7c15ULL) >> 58];
+		}
+};
+
 //
 // Common functions
 //
@@ -83,7 +272,8 @@ string extractMacro(string, Instruction* I);
 
 DILocation *getSourceLocation(Instruction *I);
 
-void printSourceCodeInfo(Value *V, string Tag = "VALUE", string SrcRoot="");
+void printSourceCodeInfo(Value *V, string Tag = "VALUE", string SrcRoot="",
+		raw_ostream &OS = OP);
 void printSourceCodeInfo(Function *F, string Tag = "FUNC", string SrcRoot="");
 void WriteSourceInfoIntoFile(Function *F, string file_name, string SrcRoot="");
 void WriteSourceInfoIntoFile(Value *V, string file_name, string SrcRoot="");
@@ -97,17 +287,36 @@ Argument *getParamByArgNo(Function *F, int8_t ArgNo);
 
 size_t funcHash(Function *F, bool withName = false);
 size_t callHash(CallInst *CI);
-void structTypeHash(StructType *STy, set<size_t> &HSet);
-size_t typeHash(Type *Ty);
-size_t typeIdxHash(Type *Ty, int Idx = -1);
-size_t hashIdxHash(size_t Hs, int Idx = -1);
+void structTypeHash(StructType *STy, set<TypeFP> &HSet);
+TypeFP typeHash(Type *Ty);
+// Hash of a named struct type by its name, e.g., "struct.file"
+TypeFP structNameHash(StringRef Name);
+// Drop cached type hashes; needed when a context is released
+void invalidateTypeHashCache();
+TypeFP typeIdxHash(Type *Ty, int Idx = -1);
+TypeFP hashIdxHash(TypeFP Hs, int Idx = -1);
 size_t strIntHash(string str, int i);
-size_t moduleTypeHash(Module *M, size_t TyH);
-string structTyStr(StructType *STy);
 bool trimPathSlash(string &path, int slash);
 int64_t getGEPOffset(const Value *V, const DataLayout *DL);
 void LoadElementsStructNameMap(
 		vector<pair<Module*, StringRef>> &Modules);
+void AddElementsStructNames(Module *M);
+// Digest of the state typeHash() depends on for the types of M,
+// besides the types themselves
+uint64_t typeHashDigest(Module *M);
+
+// Run Fn(0) ... Fn(N - 1) on a process-wide pool of Jobs threads (0
+// means all hardware threads); runs inline when Jobs is 1. Fn must
+// not call parallelFor, as the pool is shared.
+void parallelFor(unsigned Jobs, size_t N, function_ref<void(size_t)> Fn);
+
+// Resource accounting of analysis stages. A stage runs from
+// beginStage() to the next endStage(); stages do not nest.
+void beginStage(const string &Name);
+void endStage();
+// Print wall and CPU time, peak RSS so far and page faults of each
+// stage, and of the child processes reaped in it
+void printStageUsage();
 
 //
 // Common data structures
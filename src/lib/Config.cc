@@ -5,6 +5,8 @@ int ENABLE_TYDM = 1;
 int MAX_PHASE_CG = 2;
 
 string SRC_ROOT = "";
+string SUMMARY_CACHE_DIR = "";
+unsigned ANALYSIS_JOBS = 1;
 
 // Optional pointer to output file stream
 std::unique_ptr<std::ofstream> OUTPUT_FILE;
@@ -27,6 +27,10 @@ extern int ENABLE_TYDM;
 extern int MAX_PHASE_CG;
 extern std::unique_ptr<std::ofstream> OUTPUT_FILE;
 extern string SRC_ROOT;
+// Directory of per-module summaries; caching is off if empty
+extern string SUMMARY_CACHE_DIR;
+// Number of threads for the analysis (0: all cores); 1 is serial
+extern unsigned ANALYSIS_JOBS;
 
 #define SOUND_MODE 1
 #define UNROLL_LOOP_ONCE 1
@@ -143,9 +147,8 @@ static void LoadTraces(map<size_t, set<size_t>> &hashedTraces,
 //
 //////////////////////////////////////////////////////////
 
-static void LoadTargetTypes(set<size_t> &TTySet) {
+static void LoadTargetTypes(set<TypeFP> &TTySet) {
 
-	hash<string> str_hash;
 	string exepath = sys::fs::getMainExecutable(NULL, NULL);
 	string exedir = exepath.substr(0, exepath.find_last_of('/'));
 	string line;
@@ -154,7 +157,7 @@ static void LoadTargetTypes(set<size_t> &TTySet) {
 		while (!structfile.eof()) {
 			getline (structfile, line);
 			if (line.length() > 1) {
-				TTySet.insert(str_hash("struct." + line));
+				TTySet.insert(structNameHash("struct." + line));
 			}
 		}
 		structfile.close();
@@ -164,7 +167,7 @@ static void LoadTargetTypes(set<size_t> &TTySet) {
 		"struct.ksm_scan",
 	};
 	for (auto name : TTyName) {
-		TTySet.insert(str_hash(name));
+		TTySet.insert(structNameHash(name));
 	}
 }
 
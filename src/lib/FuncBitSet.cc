@@ -0,0 +1,249 @@
+//===-- FuncBitSet.cc - Bitsets of functions ---------------------===//
+//
+// Word kernels for the set algebra of FuncBitSet. On x86-64 the AVX2
+// kernels are picked at startup if the CPU supports them; SSE2 is
+// part of x86-64 and otherwise used. Other targets use the scalar
+// kernels.
+//
+//===-----------------------------------------------------------===//
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define FBS_X86 1
+#endif
+
+#include "FuncBitSet.h"
+
+//
+// Scalar kernels
+//
+
+static void andWordsScalar(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	for (size_t i = 0; i < N; ++i)
+		Dst[i] = A[i] & B[i];
+}
+
+static void orWordsScalar(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	for (size_t i = 0; i < N; ++i)
+		Dst[i] = A[i] | B[i];
+}
+
+static size_t countWordsScalar(const uint64_t *A, size_t N) {
+	size_t Count = 0;
+	for (size_t i = 0; i < N; ++i)
+		Count += __builtin_popcountll(A[i]);
+	return Count;
+}
+
+#ifdef FBS_X86
+
+//
+// SSE2 kernels
+//
+
+static void andWordsSSE2(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	size_t i = 0;
+	for (; i + 2 <= N; i += 2) {
+		__m128i V = _mm_and_si128(
+				_mm_loadu_si128((const __m128i *)(A + i)),
+				_mm_loadu_si128((const __m128i *)(B + i)));
+		_mm_storeu_si128((__m128i *)(Dst + i), V);
+	}
+	andWordsScalar(Dst + i, A + i, B + i, N - i);
+}
+
+static void orWordsSSE2(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	size_t i = 0;
+	for (; i + 2 <= N; i += 2) {
+		__m128i V = _mm_or_si128(
+				_mm_loadu_si128((const __m128i *)(A + i)),
+				_mm_loadu_si128((const __m128i *)(B + i)));
+		_mm_storeu_si128((__m128i *)(Dst + i), V);
+	}
+	orWordsScalar(Dst + i, A + i, B + i, N - i);
+}
+
+__attribute__((target("popcnt")))
+static size_t countWordsPopcnt(const uint64_t *A, size_t N) {
+	size_t Count = 0;
+	for (size_t i = 0; i < N; ++i)
+		Count += _mm_popcnt_u64(A[i]);
+	return Count;
+}
+
+//
+// AVX2 kernels
+//
+
+__attribute__((target("avx2")))
+static void andWordsAVX2(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	size_t i = 0;
+	for (; i + 4 <= N; i += 4) {
+		__m256i V = _mm256_and_si256(
+				_mm256_loadu_si256((const __m256i *)(A + i)),
+				_mm256_loadu_si256((const __m256i *)(B + i)));
+		_mm256_storeu_si256((__m256i *)(Dst + i), V);
+	}
+	andWordsScalar(Dst + i, A + i, B + i, N - i);
+}
+
+__attribute__((target("avx2")))
+static void orWordsAVX2(uint64_t *Dst, const uint64_t *A,
+		const uint64_t *B, size_t N) {
+	size_t i = 0;
+	for (; i + 4 <= N; i += 4) {
+		__m256i V = _mm256_or_si256(
+				_mm256_loadu_si256((const __m256i *)(A + i)),
+				_mm256_loadu_si256((const __m256i *)(B + i)));
+		_mm256_storeu_si256((__m256i *)(Dst + i), V);
+	}
+	orWordsScalar(Dst + i, A + i, B + i, N - i);
+}
+
+// Nibble lookup with vpshufb, summed per 64-bit lane with vpsadbw
+__attribute__((target("avx2,popcnt")))
+static size_t countWordsAVX2(const uint64_t *A, size_t N) {
+	const __m256i Lookup = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i Low = _mm256_set1_epi8(0x0f);
+	__m256i Acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 4 <= N; i += 4) {
+		__m256i V = _mm256_loadu_si256((const __m256i *)(A + i));
+		__m256i Cnt = _mm256_add_epi8(
+				_mm256_shuffle_epi8(Lookup, _mm256_and_si256(V, Low)),
+				_mm256_shuffle_epi8(Lookup,
+					_mm256_and_si256(_mm256_srli_epi16(V, 4), Low)));
+		Acc = _mm256_add_epi64(Acc,
+				_mm256_sad_epu8(Cnt, _mm256_setzero_si256()));
+	}
+	size_t Count = _mm256_extract_epi64(Acc, 0) + _mm256_extract_epi64(Acc, 1)
+		+ _mm256_extract_epi64(Acc, 2) + _mm256_extract_epi64(Acc, 3);
+	return Count + countWordsPopcnt(A + i, N - i);
+}
+
+#endif
+
+//
+// Kernel selection
+//
+
+struct BitSetKernels {
+	void (*andWords)(uint64_t *, const uint64_t *, const uint64_t *, size_t);
+	void (*orWords)(uint64_t *, const uint64_t *, const uint64_t *, size_t);
+	size_t (*countWords)(const uint64_t *, size_t);
+};
+
+static BitSetKernels selectKernels() {
+	BitSetKernels K = {andWordsScalar, orWordsScalar, countWordsScalar};
+#ifdef FBS_X86
+	__builtin_cpu_init();
+	K.andWords = andWordsSSE2;
+	K.orWords = orWordsSSE2;
+	if (__builtin_cpu_supports("popcnt"))
+		K.countWords = countWordsPopcnt;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		K.andWords = andWordsAVX2;
+		K.orWords = orWordsAVX2;
+		K.countWords = countWordsAVX2;
+	}
+#endif
+	return K;
+}
+
+static const BitSetKernels Kernels = selectKernels();
+
+//
+// FuncBitSet
+//
+
+void FuncBitSet::set(unsigned ID) {
+	size_t W = ID / 64;
+	if (Words.empty()) {
+		Begin = W;
+		Words.push_back(0);
+	}
+	else if (W < Begin) {
+		Words.insert(Words.begin(), Begin - W, 0);
+		Begin = W;
+	}
+	else if (W >= Begin + Words.size())
+		Words.resize(W - Begin + 1, 0);
+	Words[W - Begin] |= 1ULL << (ID % 64);
+}
+
+bool FuncBitSet::test(unsigned ID) const {
+	size_t W = ID / 64;
+	if (W < Begin || W >= Begin + Words.size())
+		return false;
+	return (Words[W - Begin] >> (ID % 64)) & 1;
+}
+
+size_t FuncBitSet::count() const {
+	return Kernels.countWords(Words.data(), Words.size());
+}
+
+void FuncBitSet::trim() {
+	size_t Lo = 0, Hi = Words.size();
+	while (Lo < Hi && !Words[Lo])
+		++Lo;
+	while (Hi > Lo && !Words[Hi - 1])
+		--Hi;
+	if (Lo == Hi) {
+		clear();
+		return;
+	}
+	if (Hi < Words.size())
+		Words.resize(Hi);
+	if (Lo) {
+		Words.erase(Words.begin(), Words.begin() + Lo);
+		Begin += Lo;
+	}
+}
+
+FuncBitSet &FuncBitSet::operator|=(const FuncBitSet &Other) {
+	if (Other.empty())
+		return *this;
+	if (empty()) {
+		*this = Other;
+		return *this;
+	}
+
+	size_t NewBegin = std::min(Begin, Other.Begin);
+	size_t NewEnd = std::max(Begin + Words.size(),
+			Other.Begin + Other.Words.size());
+	if (NewBegin < Begin)
+		Words.insert(Words.begin(), Begin - NewBegin, 0);
+	Words.resize(NewEnd - NewBegin, 0);
+	Begin = NewBegin;
+
+	uint64_t *Dst = Words.data() + (Other.Begin - Begin);
+	Kernels.orWords(Dst, Dst, Other.Words.data(), Other.Words.size());
+	return *this;
+}
+
+void FuncBitSet::intersect(const FuncBitSet &A, const FuncBitSet &B,
+		FuncBitSet &Out) {
+	size_t Lo = std::max(A.Begin, B.Begin);
+	size_t Hi = std::min(A.Begin + A.Words.size(), B.Begin + B.Words.size());
+	if (Lo >= Hi) {
+		Out.clear();
+		return;
+	}
+
+	// Out may be A or B
+	std::vector<uint64_t> Words(Hi - Lo);
+	Kernels.andWords(Words.data(), A.Words.data() + (Lo - A.Begin),
+			B.Words.data() + (Lo - B.Begin), Hi - Lo);
+	Out.Words.swap(Words);
+	Out.Begin = Lo;
+	Out.trim();
+}
@@ -0,0 +1,49 @@
+#ifndef _FUNC_BIT_SET_H
+#define _FUNC_BIT_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// A set of functions by their dense IDs (GlobalContext::FuncIDs).
+// Only the words between the lowest and the highest member are
+// stored, as the members of a set are mostly functions of one
+// signature, which get adjacent IDs. Set algebra runs on whole words
+// with AVX2 or SSE2 kernels where the CPU has them.
+//
+class FuncBitSet {
+
+	public:
+		void set(unsigned ID);
+		bool test(unsigned ID) const;
+		bool empty() const { return Words.empty(); }
+		void clear() { Words.clear(); Begin = 0; }
+		size_t count() const;
+
+		FuncBitSet &operator|=(const FuncBitSet &Other);
+		// Out = A & B
+		static void intersect(const FuncBitSet &A, const FuncBitSet &B,
+				FuncBitSet &Out);
+
+		template <typename Fn>
+		void forEach(Fn F) const {
+			for (size_t i = 0; i < Words.size(); ++i) {
+				uint64_t W = Words[i];
+				while (W) {
+					F((unsigned)((Begin + i) * 64 + __builtin_ctzll(W)));
+					W &= W - 1;
+				}
+			}
+		}
+
+	private:
+		// Index of the first stored word
+		size_t Begin = 0;
+		// Stored words; the first and the last are never zero
+		std::vector<uint64_t> Words;
+
+		void trim();
+};
+
+#endif
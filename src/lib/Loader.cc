@@ -0,0 +1,103 @@
+//===-- Loader.cc - Load input modules ---------------------------===//
+//
+// Input modules are parsed with the IR reader. Textual IR (.ll) is
+// expensive to parse, so a bitcode copy of it can be kept in a cache
+// directory; the copy is keyed by the path, size and modification
+// time of the textual file.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+#include "Loader.h"
+
+using namespace llvm;
+
+// Location of the bitcode copy of a textual file; empty if the file
+// cannot be cached
+static std::string getCachePath(const std::string &Filename,
+		const std::string &CacheDir)
+{
+	if (sys::path::extension(Filename) != ".ll")
+		return "";
+
+	SmallString<256> AbsPath(Filename);
+	sys::fs::file_status Status;
+	if (sys::fs::make_absolute(AbsPath) || sys::fs::status(AbsPath, Status))
+		return "";
+
+	// The LLVM version is part of the key since the bitcode format
+	// is not stable across versions
+	std::string Key;
+	raw_string_ostream KeyOS(Key);
+	KeyOS << AbsPath << "|" << Status.getSize() << "|"
+		<< Status.getLastModificationTime().time_since_epoch().count()
+		<< "|" << LLVM_VERSION_STRING;
+	KeyOS.flush();
+
+	SmallString<256> CachePath(CacheDir);
+	sys::path::append(CachePath, utohexstr(xxHash64(Key)) + ".bc");
+	return std::string(CachePath.str());
+}
+
+// Write the bitcode to a unique temporary file and rename it, so
+// that concurrent runs never see a partially written cache entry
+static void writeCache(Module &M, const std::string &CachePath)
+{
+	int FD;
+	SmallString<256> TmpPath;
+	if (sys::fs::createUniqueFile(CachePath + "-%%%%%%.tmp", FD, TmpPath))
+		return;
+
+	{
+		raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		WriteBitcodeToFile(M, OS);
+		OS.close();
+		if (OS.has_error())
+		{
+			OS.clear_error();
+			sys::fs::remove(TmpPath);
+			return;
+		}
+	}
+
+	if (sys::fs::rename(TmpPath, CachePath))
+		sys::fs::remove(TmpPath);
+}
+
+std::unique_ptr<Module> loadIRFile(const std::string &Filename,
+		SMDiagnostic &Err, LLVMContext &Context,
+		const std::string &CacheDir)
+{
+	std::string CachePath;
+	if (!CacheDir.empty())
+		CachePath = getCachePath(Filename, CacheDir);
+
+	if (CachePath.empty())
+		return parseIRFile(Filename, Err, Context);
+
+	if (sys::fs::exists(CachePath))
+	{
+		SMDiagnostic CacheErr;
+		std::unique_ptr<Module> M =
+			parseIRFile(CachePath, CacheErr, Context);
+		if (M)
+		{
+			// Modules are identified by their input files
+			M->setModuleIdentifier(Filename);
+			return M;
+		}
+		// Fall back to the textual file for a broken entry
+	}
+
+	std::unique_ptr<Module> M = parseIRFile(Filename, Err, Context);
+	if (M)
+		writeCache(*M, CachePath);
+	return M;
+}
@@ -0,0 +1,21 @@
+#ifndef _LOADER_H
+#define _LOADER_H
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+//
+// Loading of input modules. Textual IR inputs can be cached as
+// bitcode in CacheDir, which is much faster to read on later runs
+//
+std::unique_ptr<Module> loadIRFile(const std::string &Filename,
+		SMDiagnostic &Err, LLVMContext &Context,
+		const std::string &CacheDir);
+
+#endif
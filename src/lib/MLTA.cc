@@ -43,7 +43,7 @@ map<Module *, Type *>MLTA::Int8PtrTy;
 pair<Type *, int> typeidx_c(Type *Ty, int Idx) {
 	return make_pair(Ty, Idx);
 }
-pair<size_t, int> hashidx_c(size_t Hash, int Idx) {
+pair<TypeFP, int> hashidx_c(TypeFP Hash, int Idx) {
 	return make_pair(Hash, Idx);
 }
 
@@ -95,10 +95,9 @@ void MLTA::findCalleesWithType(CallInst *CI, FuncSet &S) {
 	// Performance improvement: cache results for types
 	//
 	size_t CIH = callHash(CI);
-	if (MatchedFuncsMap.find(CIH) != MatchedFuncsMap.end()) {
-		if (!MatchedFuncsMap[CIH].empty())
-			S.insert(MatchedFuncsMap[CIH].begin(), 
-					MatchedFuncsMap[CIH].end());
+	FuncSet Matched;
+	if (MatchedFuncsMap.lookup(CIH, Matched)) {
+		S.insert(Matched.begin(), Matched.end());
 		return;
 	}
 
@@ -157,7 +156,7 @@ void MLTA::findCalleesWithType(CallInst *CI, FuncSet &S) {
 			S.insert(F);
 		}
 	}
-	MatchedFuncsMap[CIH] = S;
+	MatchedFuncsMap.insert(CIH, S);
 }
 
 
@@ -278,11 +277,9 @@ Type *MLTA::getFuncPtrType(Value *V) {
 
 Value *MLTA::recoverBaseType(Value *V) {
 	if (Instruction *I = dyn_cast<Instruction>(V)) {
-		map<Value *, Value *> &AliasMap 
-			= AliasStructPtrMap[I->getFunction()];
-		if (AliasMap.find(V) != AliasMap.end()) {
-			return AliasMap[V];
-		}
+		auto It = AliasStructPtrMap.find(I->getFunction());
+		if (It != AliasStructPtrMap.end())
+			return It->second.lookup(V);
 	}
 	return NULL;
 }
@@ -419,17 +416,16 @@ bool MLTA::typeConfineInInitializer(GlobalVariable *GV) {
 	list<pair<Type *, int>>NestedInit;
 	map<Value *, pair<Value *, int>>ContainersMap;
 	set<Value *>FuncOperands;
-	list<User *>LU;
-	set<Value *>Visited;
+	Worklist<User *>LU;
+	VisitedSet<Value *>Visited;
 	LU.push_back(Ini);
 
 	while (!LU.empty()) {
 		User *U = LU.front();
 		LU.pop_front();
-		if (Visited.find(U) != Visited.end()) {
+		if (!Visited.insert(U)) {
 			continue;
 		}
-		Visited.insert(U);
 
 		Type *UTy = U->getType();
 		assert(!UTy->isFunctionTy());
@@ -527,12 +523,12 @@ bool MLTA::typeConfineInInitializer(GlobalVariable *GV) {
 
 				// Add the function type to all containers
 				Value *CV = O;
-				set<Value *>Visited; // to avoid loop
+				VisitedSet<Value *>Visited; // to avoid loop
 				while (ContainersMap.find(CV) != ContainersMap.end()) {
 					auto Container = ContainersMap[CV];
 
 					Type *CTy = Container.first->getType();
-					set<size_t> TyHS;
+					set<TypeFP> TyHS;
 					if (StructType *STy = dyn_cast<StructType>(CTy)) {
 						structTypeHash(STy, TyHS);
 					}
@@ -555,7 +551,7 @@ bool MLTA::typeConfineInInitializer(GlobalVariable *GV) {
 					}
 
 					Visited.insert(CV);
-					if (Visited.find(Container.first) != Visited.end())
+					if (Visited.count(Container.first))
 						break;
 
 					CV = Container.first;
@@ -604,17 +600,17 @@ bool MLTA::typeConfineInFunction(Function *F) {
 					Function *CF = dyn_cast<Function>(CV);
 					if (!CF)
 						continue;
-					if (CF->isDeclaration())
-						CF = Ctx->GlobalFuncMap[CF->getGUID()];
-					if (!CF)
-						continue;
-					if (Argument *Arg = getParamByArgNo(CF, OI->getOperandNo())) {
-						for (auto U : Arg->users()) {
-							if (isa<StoreInst>(U) || isa<BitCastOperator>(U)) {
-								confineTargetFunction(U, F);
-							}
+					if (CF->isDeclaration()) {
+						if (DeferredCallConfines) {
+							DeferredCallConfines->push_back(
+									{CF->getGUID(), OI->getOperandNo(), F});
+							continue;
 						}
+						CF = Ctx->GlobalFuncMap.lookup(CF->getGUID());
 					}
+					if (!CF)
+						continue;
+					typeConfineInCallArg(CF, OI->getOperandNo(), F);
 					// TODO: track into the callee to avoid marking the
 					// function type as a cap
 				}
@@ -625,6 +621,19 @@ bool MLTA::typeConfineInFunction(Function *F) {
 	return true;
 }
 
+// F is passed as the ArgNo-th argument of a direct call to CF
+void MLTA::typeConfineInCallArg(Function *CF, unsigned ArgNo, 
+		Function *F) {
+
+	if (Argument *Arg = getParamByArgNo(CF, ArgNo)) {
+		for (auto U : Arg->users()) {
+			if (isa<StoreInst>(U) || isa<BitCastOperator>(U)) {
+				confineTargetFunction(U, F);
+			}
+		}
+	}
+}
+
 bool MLTA::typePropInFunction(Function *F) {
 
 	// Two cases for propagation: store and cast. 
@@ -664,7 +673,7 @@ bool MLTA::typePropInFunction(Function *F) {
 
 			list<typeidx_t>TyList;
 			Value *NextV = NULL;
-			set<Value *> Visited;
+			VisitedSet<Value *> Visited;
 			nextLayerBaseType(VO, TyList, NextV, Visited);
 			if (!TyList.empty()) {
 				for (auto TyIdx : TyList) {
@@ -743,7 +752,7 @@ bool MLTA::typePropInFunction(Function *F) {
 // This function precisely collects alias types for general pointers
 void MLTA::collectAliasStructPtr(Function *F) {
 
-	map<Value *, Value *> &AliasMap = AliasStructPtrMap[F];
+	DenseMap<Value *, Value *> &AliasMap = AliasStructPtrMap[F];
 	set<Value *>ToErase;
 	for (inst_iterator i = inst_begin(F), e = inst_end(F); 
 			i != e; ++i) {
@@ -810,7 +819,7 @@ void MLTA::confineTargetFunction(Value *V, Function *F) {
 		if (!TyChain.empty())
 			typeCapSet.insert(typeHash(TyChain.back().first));
 		else
-			typeCapSet.insert(funcHash(F));
+			typeCapSet.insert(typeHash(F->getFunctionType()));
 	}
 }
 
@@ -831,13 +840,9 @@ void MLTA::propagateType(Value *ToV, Type *FromTy, int Idx) {
 	}
 }
 
-void MLTA::intersectFuncSets(FuncSet &FS1, FuncSet &FS2, 
-		FuncSet &FS) {
-	FS.clear();
-	for (auto F : FS1) {
-		if (FS2.find(F) != FS2.end())
-			FS.insert(F);
-	}
+void MLTA::intersectFuncSets(FuncBitSet &FS1, FuncBitSet &FS2, 
+		FuncBitSet &FS) {
+	FuncBitSet::intersect(FS1, FS2, FS);
 }
 
 Value *MLTA::getVTable(Value *V) {
@@ -910,7 +915,7 @@ void MLTA::printTypeChain(list<typeidx_t> &Chain) {
 	OP<<"\n";
 }
 
-void MLTA::dumpTargets(FuncSet &FS, CallInst *CI) {
+void MLTA::dumpTargets(const FuncSet &FS, CallInst *CI) {
 	if (!OUTPUT_FILE)
 		return;
 
@@ -951,7 +956,7 @@ void MLTA::dumpTargets(FuncSet &FS, CallInst *CI) {
 	}
 }
 
-void MLTA::printTargets(FuncSet &FS, CallInst *CI) {
+void MLTA::printTargets(const FuncSet &FS, CallInst *CI) {
 
 	if (CI) {
 #ifdef PRINT_SOURCE_LINE
@@ -989,7 +994,7 @@ bool MLTA::getBaseTypeChain(list<typeidx_t> &Chain, Value *V,
 	Complete = true;
 	Value *CV = V, *NextV = NULL;
 	list<typeidx_t> TyList;
-	set<Value *>Visited;
+	VisitedSet<Value *>Visited;
 
 	Type *BTy = getBaseType(V, Visited);
 	if (BTy) {
@@ -1034,14 +1039,13 @@ bool MLTA::getBaseTypeChain(list<typeidx_t> &Chain, Value *V,
 // This function is to get the base type in the current layer.
 // To get the type of next layer (with GEP and Load), use
 // nextLayerBaseType() instead.
-Type *MLTA::getBaseType(Value *V, set<Value *> &Visited) {
+Type *MLTA::getBaseType(Value *V, VisitedSet<Value *> &Visited) {
 
 	if (!V)
 		return NULL;
 
-	if (Visited.find(V) != Visited.end())
+	if (!Visited.insert(V))
 		return NULL;
-	Visited.insert(V);
 
 	Type *Ty = V->getType();
 
@@ -1085,7 +1089,7 @@ Type *MLTA::getBaseType(Value *V, set<Value *> &Visited) {
 	return NULL;
 }
 
-Type *MLTA::_getPhiBaseType(PHINode *PN, set<Value *> &Visited) {
+Type *MLTA::_getPhiBaseType(PHINode *PN, VisitedSet<Value *> &Visited) {
 
 	for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
 		Value *IV = PN->getIncomingValue(i);
@@ -1226,19 +1230,18 @@ bool MLTA::getGEPLayerTypes(GEPOperator *GEP, list<typeidx_t> &TyList) {
 bool MLTA::nextLayerBaseTypeWL(Value *V, list<typeidx_t> &TyList,
 		Value * &NextV) {
 
-	list<Value *> VL;
-	set<Value *>Visited;
+	Worklist<Value *> VL;
+	VisitedSet<Value *>Visited;
 	VL.push_back(V);
 
 	while (!VL.empty()) {
 
 		Value *CV = VL.front();
 		VL.pop_front();
-		if (Visited.find(CV) != Visited.end()) {
+		if (!Visited.insert(CV)) {
 			NextV = CV;
 			continue;
 		}
-		Visited.insert(CV);
 
 		if (!CV || isa<Argument>(CV)) {
 			NextV = CV;
@@ -1291,18 +1294,17 @@ bool MLTA::nextLayerBaseTypeWL(Value *V, list<typeidx_t> &TyList,
 // Get the composite type of the lower layer. Layers are split by
 // memory loads or GEP
 bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
-		Value * &NextV, set<Value *> &Visited) {
+		Value * &NextV, VisitedSet<Value *> &Visited) {
 
 	if (!V || isa<Argument>(V)) {
 		NextV = V;
 		return false;
 	}
 
-	if (Visited.find(V) != Visited.end()) {
+	if (!Visited.insert(V)) {
 		NextV = V;
 		return false;
 	}
-	Visited.insert(V);
 
 	// The only way to get the next layer type: GetElementPtrInst or
 	// GEPOperator
@@ -1328,21 +1330,21 @@ bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList,
 	// Phi and Select 
 	else if (PHINode *PN = dyn_cast<PHINode>(V)) {
 		// FIXME: tracking incoming values
+		// Each incoming value is tried from the same state; the
+		// visits and types of a failed try are undone
 		bool ret = false;
-		set<Value *> NVisited;
-		list<typeidx_t> NTyList;
+		size_t VisitedMark = Visited.mark();
+		size_t TyListSize = TyList.size();
 		for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
 			Value *IV = PN->getIncomingValue(i);
 			NextV = IV;
-			NVisited = Visited;
-			NTyList = TyList;
-			ret = nextLayerBaseType(IV, NTyList, NextV, NVisited);
-			if (NTyList.size() > TyList.size()) {
+			Visited.rollback(VisitedMark);
+			TyList.resize(TyListSize);
+			ret = nextLayerBaseType(IV, TyList, NextV, Visited);
+			if (TyList.size() > TyListSize) {
 				break;
 			}
 		}
-		TyList = NTyList;
-		Visited = NVisited;
 		return ret;
 	}
 	else if (SelectInst *SelI = dyn_cast<SelectInst>(V)) {
@@ -1366,25 +1368,28 @@ bool MLTA::nextLayerBaseType(Value *V, list<typeidx_t> &TyList,
 bool MLTA::getDependentTypes(Type *Ty, int Idx, 
 		set<hashidx_t> &PropSet) {
 
-	list<hashidx_t>LT;
+	Worklist<hashidx_t>LT;
 	LT.push_back(hashidx_c(typeHash(Ty), Idx));
-	set<hashidx_t>Visited;
+	VisitedSet<hashidx_t>Visited;
 
 	while (!LT.empty()) {
 		hashidx_t TI = LT.front();
 		LT.pop_front();
-		if (Visited.find(TI) != Visited.end()) {
+		if (!Visited.insert(TI)) {
 			continue;
 		}
-		Visited.insert(TI);
 
-		for (auto Prop : typeIdxPropMap[TI.first][TI.second]) {
-			PropSet.insert(Prop);
-			LT.push_back(Prop);
-		}
-		for (auto Prop : typeIdxPropMap[TI.first][-1]) {
-			PropSet.insert(Prop);
-			LT.push_back(Prop);
+		auto It = typeIdxPropMap.find(TI.first);
+		if (It == typeIdxPropMap.end())
+			continue;
+		for (int Idx : {TI.second, -1}) {
+			auto PIt = It->second.find(Idx);
+			if (PIt == It->second.end())
+				continue;
+			for (auto Prop : PIt->second) {
+				PropSet.insert(Prop);
+				LT.push_back(Prop);
+			}
 		}
 	}
 	return true;
@@ -1409,44 +1414,84 @@ Function *MLTA::getBaseFunction(Value *V) {
 	return NULL;
 }
 
-// Get all possible targets of the given type
-bool MLTA::getTargetsWithLayerType(size_t TyHash, int Idx, 
-		FuncSet &FS) {
+// Functions that are not numbered cannot be in a signature set, so
+// they are dropped
+static void addFuncBits(GlobalContext *Ctx, FuncSet &FSet, 
+		FuncBitSet &FS) {
+	for (auto F : FSet) {
+		auto It = Ctx->FuncIDs.find(F);
+		if (It != Ctx->FuncIDs.end())
+			FS.set(It->second);
+	}
+}
+
+// Get all possible targets of the given type. FS gets only these:
+// callers pass in sets that still hold the previous layer, and a -1
+// layer must not keep those.
+// Lookups do not insert, as resolving threads share the map.
+bool MLTA::getTargetsWithLayerType(TypeFP TyHash, int Idx, 
+		FuncBitSet &FS) {
+
+	FS.clear();
+	auto It = typeIdxFuncsMap.find(TyHash);
+	if (It == typeIdxFuncsMap.end())
+		return true;
 
-	// Get the direct funcset in the current layer, which
-	// will be further unioned with other targets from type
-	// casting
 	if (Idx == -1) {
-		for (auto FSet : typeIdxFuncsMap[TyHash]) {
-			FS.insert(FSet.second.begin(), FSet.second.end());
+		for (auto &FSet : It->second) {
+			addFuncBits(Ctx, FSet.second, FS);
 		}
 	}
 	else {
-		FS = typeIdxFuncsMap[TyHash][Idx];
-		FS.insert(typeIdxFuncsMap[TyHash][-1].begin(), 
-				typeIdxFuncsMap[TyHash][-1].end());
+		for (int I : {Idx, -1}) {
+			auto IIt = It->second.find(I);
+			if (IIt != It->second.end())
+				addFuncBits(Ctx, IIt->second, FS);
+		}
 	}
 
 	return true;
 }
 
+void MLTA::numberAddrTakenFuncs() {
+
+	Ctx->FuncIDs.clear();
+	Ctx->FuncsByID.clear();
+	sigFuncBitsMap.clear();
+	MatchedTypeIdxFuncsMap.clear();
+
+	// Functions of a signature get adjacent IDs, so that the sets of
+	// a call are mostly within a few words
+	for (auto &SF : Ctx->sigFuncsMap) {
+		FuncBitSet &Bits = sigFuncBitsMap[SF.first];
+		for (auto F : SF.second) {
+			auto It = Ctx->FuncIDs.insert(
+					make_pair(F, (unsigned)Ctx->FuncsByID.size()));
+			if (It.second)
+				Ctx->FuncsByID.push_back(F);
+			Bits.set(It.first->second);
+		}
+	}
+}
+
 // The API for MLTA: it returns functions for an indirect call
 bool MLTA::findCalleesWithMLTA(CallInst *CI, 
-		FuncSet &FS) {
+		FuncSet &FS, MLTAStats &Stats) {
 
 	// Initial set: first-layer results
 	// TODO: handling virtual functions
-	FS = Ctx->sigFuncsMap[callHash(CI)];
+	FS.clear();
+	FuncBitSet FSBits = sigFuncBitsMap.lookup(callHash(CI));
 
-	if (FS.empty()) {
+	if (FSBits.empty()) {
 		// No need to go through MLTA if the first layer is empty
 		return false;
 	}
 
-	Ctx->NumFirstLayerTargets += FS.size();
-	Ctx->NumFirstLayerTypeCalls += 1;
+	Stats.NumFirstLayerTargets += FSBits.count();
+	Stats.NumFirstLayerTypeCalls += 1;
 
-	FuncSet FS1, FS2;
+	FuncBitSet FS1, FS2;
 	Type *PrevLayerTy = (dyn_cast<CallBase>(CI))->getFunctionType();
 	int PrevIdx = -1;
 	Value *CV = CI->getCalledOperand();
@@ -1468,7 +1513,7 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 		}
 #endif
 
-		set<Value *> Visited;
+		VisitedSet<Value *> Visited;
 		nextLayerBaseType(CV, TyList, NextV, Visited);
 		if (TyList.empty()) {
 			if (LayerNo == 1) {
@@ -1487,15 +1532,12 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 				<<"; Idx: "<<TyIdx.second<<"\n";
 			DBG<<"[HASH] "<<typeHash(TyIdx.first)<<"\n";
 
-			size_t TyIdxHash = typeIdxHash(TyIdx.first, TyIdx.second);
+			TypeFP TyIdxHash = typeIdxHash(TyIdx.first, TyIdx.second);
 			// -1 represents all possible fields of a struct
-			size_t TyIdxHash_1 = typeIdxHash(TyIdx.first, -1);
+			TypeFP TyIdxHash_1 = typeIdxHash(TyIdx.first, -1);
 
 			// Caching for performance
-			if (MatchedFuncsMap.find(TyIdxHash) != MatchedFuncsMap.end()) {
-				FS1 = MatchedFuncsMap[TyIdxHash];
-			}
-			else {
+			if (!MatchedTypeIdxFuncsMap.lookup(TyIdxHash, FS1)) {
 
 #ifdef SOUND_MODE
 				if (typeEscapeSet.find(TyIdxHash) 
@@ -1535,15 +1577,15 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 				getDependentTypes(TyIdx.first, TyIdx.second, PropSet);
 				for (auto Prop : PropSet) {
 					getTargetsWithLayerType(Prop.first, Prop.second, FS2);
-					FS1.insert(FS2.begin(), FS2.end());
+					FS1 |= FS2;
 				}
-				MatchedFuncsMap[TyIdxHash] = FS1;
+				MatchedTypeIdxFuncsMap.insert(TyIdxHash, FS1);
 			}
 
 			// Next layer may not always have a subset of the previous layer
 			// because of casting, so let's do intersection
-			intersectFuncSets(FS1, FS, FS2);
-			FS = FS2;
+			intersectFuncSets(FS1, FSBits, FS2);
+			FSBits = FS2;
 
 			CV = NextV;
 
@@ -1561,10 +1603,12 @@ bool MLTA::findCalleesWithMLTA(CallInst *CI,
 	}
 
 	if (LayerNo > 1) {
-		Ctx->NumSecondLayerTypeCalls++;
-		Ctx->NumSecondLayerTargets += FS.size();
+		Stats.NumSecondLayerTypeCalls++;
+		Stats.NumSecondLayerTargets += FSBits.count();
 	}
 
+	FSBits.forEach([&](unsigned ID) { FS.insert(Ctx->FuncsByID[ID]); });
+
 #if 0
 	FuncSet FSBase = Ctx->sigFuncsMap[callHash(CI)];
 	saveCalleesInfo(CI, FSBase, false);
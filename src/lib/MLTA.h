@@ -3,12 +3,89 @@
 
 #include "Analyzer.h"
 #include "Config.h"
+#include "FuncBitSet.h"
 #include "llvm/IR/Operator.h"
 
 typedef pair<Type *, int> typeidx_t;
 pair<Type *, int> typeidx_c(Type *Ty, int Idx);
-typedef pair<size_t, int> hashidx_t;
-pair<size_t, int> hashidx_c(size_t Hash, int Idx);
+typedef pair<TypeFP, int> hashidx_t;
+pair<TypeFP, int> hashidx_c(TypeFP Hash, int Idx);
+
+//
+// Field indices of a type. The first 64 fields are kept in a mask;
+// others, including -1, in a short vector. Lookups never allocate.
+//
+class FieldSet {
+
+	public:
+		bool insert(int Idx) {
+			if (Idx >= 0 && Idx < 64) {
+				uint64_t Bit = 1ULL << Idx;
+				bool New = !(Mask & Bit);
+				Mask |= Bit;
+				return New;
+			}
+			if (count(Idx))
+				return false;
+			Others.push_back(Idx);
+			return true;
+		}
+		bool count(int Idx) const {
+			if (Idx >= 0 && Idx < 64)
+				return (Mask >> Idx) & 1;
+			return llvm::is_contained(Others, Idx);
+		}
+		size_t size() const
+			{ return __builtin_popcountll(Mask) + Others.size(); }
+		FieldSet &operator|=(const FieldSet &Other) {
+			Mask |= Other.Mask;
+			for (int Idx : Other.Others)
+				insert(Idx);
+			return *this;
+		}
+		template <typename Fn>
+		void forEach(Fn F) const {
+			for (uint64_t M = Mask; M; M &= M - 1)
+				F((int)__builtin_ctzll(M));
+			for (int Idx : Others)
+				F(Idx);
+		}
+
+	private:
+		uint64_t Mask = 0;
+		SmallVector<int, 0> Others;
+};
+
+// Propagations into the fields of a type
+typedef SmallDenseSet<hashidx_t, 4> HashIdxSet;
+typedef SmallDenseMap<int, HashIdxSet, 2> IdxPropMap;
+// Stored fields and casts of types in a module
+typedef DenseMap<Type *, FieldSet> StoredFieldMap;
+typedef DenseMap<Type *, SmallPtrSet<Type *, 4>> TypeCastMap;
+
+// Function F passed to the ArgNo-th argument of a call to a function
+// defined in another module
+struct CallConfine {
+	uint64_t CalleeGUID;
+	unsigned ArgNo;
+	Function *F;
+};
+
+// Counters of resolving indirect calls with MLTA. Threads keep their
+// own, which are added to the context once they are done.
+struct MLTAStats {
+	unsigned NumFirstLayerTypeCalls = 0;
+	unsigned NumFirstLayerTargets = 0;
+	unsigned NumSecondLayerTypeCalls = 0;
+	unsigned NumSecondLayerTargets = 0;
+
+	void addTo(GlobalContext *Ctx) const {
+		Ctx->NumFirstLayerTypeCalls += NumFirstLayerTypeCalls;
+		Ctx->NumFirstLayerTargets += NumFirstLayerTargets;
+		Ctx->NumSecondLayerTypeCalls += NumSecondLayerTypeCalls;
+		Ctx->NumSecondLayerTargets += NumSecondLayerTargets;
+	}
+};
 
 class MLTA {
 
@@ -25,19 +102,24 @@ class MLTA {
 		// Important data structures for type confinement, propagation,
 		// and escapes. 
 		////////////////////////////////////////////////////////////////
-		DenseMap<size_t, map<int, FuncSet>>typeIdxFuncsMap;
-		map<size_t, map<int, set<hashidx_t>>>typeIdxPropMap;
-		set<size_t>typeEscapeSet;
+		DenseMap<TypeFP, map<int, FuncSet>>typeIdxFuncsMap;
+		DenseMap<TypeFP, IdxPropMap>typeIdxPropMap;
+		DenseSet<TypeFP>typeEscapeSet;
 		// Cap type: We cannot know where the type can be futher
 		// propagated to. Do not include idx in the hash
-		set<size_t>typeCapSet;
+		DenseSet<TypeFP>typeCapSet;
 
 
 		////////////////////////////////////////////////////////////////
 		// Other data structures
 		////////////////////////////////////////////////////////////////
-		// Cache matched functions for CallInst
-		DenseMap<size_t, FuncSet>MatchedFuncsMap;
+		// Cache matched functions for CallInst; shared by the threads
+		// resolving indirect calls
+		ConcurrentMap<size_t, FuncSet>MatchedFuncsMap;
+		// Cache matched functions for a layer type and field
+		ConcurrentMap<TypeFP, FuncBitSet>MatchedTypeIdxFuncsMap;
+		// sigFuncsMap as bitsets
+		DenseMap<size_t, FuncBitSet>sigFuncBitsMap;
 		DenseMap<Value *, FuncSet>VTableFuncsMap;
 
 		set<size_t>srcLnHashSet;
@@ -50,13 +132,17 @@ class MLTA {
 		DenseMap<size_t, FuncSet> MatchedICallTypeMap;
 
 		// Set of target types
-		set<size_t>TTySet;
+		set<TypeFP>TTySet;
 
 		// Functions that are actually stored to variables
 		FuncSet StoredFuncs;
 
 		// Alias struct pointer of a general pointer
-		map<Function *, map<Value *, Value *>>AliasStructPtrMap;
+		DenseMap<Function *, DenseMap<Value *, Value *>>AliasStructPtrMap;
+
+		// If set, confinements that depend on other modules are
+		// recorded here instead of being applied
+		vector<CallConfine> *DeferredCallConfines = NULL;
 
 
 
@@ -72,11 +158,11 @@ class MLTA {
 		void escapeType(Value *V);
 		void propagateType(Value *ToV, Type *FromTy, int Idx = -1);
 
-		Type *getBaseType(Value *V, set<Value *> &Visited);
-		Type *_getPhiBaseType(PHINode *PN, set<Value *> &Visited);
+		Type *getBaseType(Value *V, VisitedSet<Value *> &Visited);
+		Type *_getPhiBaseType(PHINode *PN, VisitedSet<Value *> &Visited);
 		Function *getBaseFunction(Value *V);
 		bool nextLayerBaseType(Value *V, list<typeidx_t> &TyList, 
-				Value * &NextV, set<Value *> &Visited);
+				Value * &NextV, VisitedSet<Value *> &Visited);
 		bool nextLayerBaseTypeWL(Value *V, list<typeidx_t> &TyList, 
 				Value * &NextV);
 		bool getGEPLayerTypes(GEPOperator *GEP, list<typeidx_t> &TyList);
@@ -89,10 +175,12 @@ class MLTA {
 		// Target-related basic functions
 		////////////////////////////////////////////////////////////////
 		void confineTargetFunction(Value *V, Function *F);
-		void intersectFuncSets(FuncSet &FS1, FuncSet &FS2,
-				FuncSet &FS); 
+		void intersectFuncSets(FuncBitSet &FS1, FuncBitSet &FS2,
+				FuncBitSet &FS); 
 		bool typeConfineInInitializer(GlobalVariable *GV);
 		bool typeConfineInFunction(Function *F);
+		void typeConfineInCallArg(Function *CF, unsigned ArgNo, 
+				Function *F);
 		bool typePropInFunction(Function *F);
 		void collectAliasStructPtr(Function *F);
 
@@ -105,11 +193,16 @@ class MLTA {
 		////////////////////////////////////////////////////////////////
 		// API functions
 		////////////////////////////////////////////////////////////////
-		// Use type-based analysis to find targets of indirect calls
+		// Use type-based analysis to find targets of indirect calls.
+		// Once the initialization is done, both can run on several
+		// threads at once.
 		void findCalleesWithType(CallInst*, FuncSet&);
-		bool findCalleesWithMLTA(CallInst *CI, FuncSet &FS);
-		bool getTargetsWithLayerType(size_t TyHash, int Idx, 
-				FuncSet &FS);
+		bool findCalleesWithMLTA(CallInst *CI, FuncSet &FS, 
+				MLTAStats &Stats);
+		bool getTargetsWithLayerType(TypeFP TyHash, int Idx, 
+				FuncBitSet &FS);
+		// Number the functions of sigFuncsMap once it is complete
+		void numberAddrTakenFuncs();
 
 
 		////////////////////////////////////////////////////////////////
@@ -123,8 +216,8 @@ class MLTA {
 
 		void unrollLoops(Function *F);
 		void saveCalleesInfo(CallInst *CI, FuncSet &FS, bool mlta);
-		void printTargets(FuncSet &FS, CallInst *CI = NULL);
-		void dumpTargets(FuncSet &FS, CallInst *CI);
+		void printTargets(const FuncSet &FS, CallInst *CI = NULL);
+		void dumpTargets(const FuncSet &FS, CallInst *CI);
 		void printTypeChain(list<typeidx_t> &Chain);
 
 
@@ -0,0 +1,441 @@
+//===-- Server.cc - Query server for analysis results ------------===//
+//
+// Answers call-graph and module-dependence queries on the state left
+// by the analysis, so that clients do not have to rerun it for each
+// query.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/AsmParser/SlotMapping.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "Server.h"
+
+using namespace llvm;
+
+// Source location of a call site, with its function
+static string callSiteStr(CallInst *CI)
+{
+	string File;
+	unsigned Line;
+	getSourceCodeInfo(CI, File, Line);
+	if (File.empty())
+		File = CI->getModule()->getName().str();
+	return File + ":" + to_string(Line) + " "
+		+ CI->getFunction()->getName().str();
+}
+
+static string funcStr(Function *F)
+{
+	string Str = F->getName().str();
+	if (DISubprogram *SP = F->getSubprogram())
+		Str += " " + SP->getFilename().str() + ":" + to_string(SP->getLine());
+	return Str;
+}
+
+// Paths in queries may be relative to the source root or the build
+static bool pathMatches(StringRef Path, StringRef Query)
+{
+	if (!Path.endswith(Query))
+		return false;
+	return Path.size() == Query.size()
+		|| Query.startswith("/")
+		|| Path[Path.size() - Query.size() - 1] == '/';
+}
+
+static bool isTypeNameChar(char C)
+{
+	return isalnum((unsigned char)C) || C == '-' || C == '$'
+		|| C == '.' || C == '_';
+}
+
+// Check that every %name in a type string, quoted or not, is one of
+// the named types; Unknown gets the first one that is not
+static bool typeNamesKnown(StringRef TypeStr, const SlotMapping &Slots,
+		string &Unknown)
+{
+	for (size_t Pos = TypeStr.find('%'); Pos != StringRef::npos;
+			Pos = TypeStr.find('%', Pos))
+	{
+		++Pos;
+		StringRef Name;
+		if (Pos < TypeStr.size() && TypeStr[Pos] == '"')
+		{
+			size_t End = TypeStr.find('"', Pos + 1);
+			if (End == StringRef::npos)
+				End = TypeStr.size();
+			Name = TypeStr.slice(Pos + 1, End);
+			Pos = End + 1;
+		}
+		else
+		{
+			size_t End = Pos;
+			while (End < TypeStr.size() && isTypeNameChar(TypeStr[End]))
+				++End;
+			Name = TypeStr.slice(Pos, End);
+			Pos = End;
+		}
+		if (!Slots.NamedTypes.count(Name))
+		{
+			Unknown = Name.str();
+			return false;
+		}
+	}
+	return true;
+}
+
+QueryServer::QueryServer(GlobalContext *Ctx_, CallGraphPass *CGPass_)
+	: Ctx(Ctx_), CGPass(CGPass_)
+{
+	buildIndexes();
+}
+
+void QueryServer::buildIndexes()
+{
+	CallGraphCSR &CG = Ctx->CG;
+	for (unsigned CS = 0; CS < CG.CallSites.size(); ++CS)
+	{
+		if (DILocation *Loc = getSourceLocation(CG.CallSites[CS]))
+			CallSitesByLine[Loc->getLine()].push_back(CS);
+	}
+
+	for (auto &MN : Ctx->Modules)
+	{
+		for (Function &F : *MN.first)
+		{
+			if (F.isDeclaration())
+				continue;
+			FuncsByName[F.getName()].push_back(&F);
+		}
+	}
+}
+
+void QueryServer::queryCallees(StringRef File, unsigned Line,
+		vector<string> &Results)
+{
+	auto It = CallSitesByLine.find(Line);
+	if (It == CallSitesByLine.end())
+		return;
+
+	CallGraphCSR &CG = Ctx->CG;
+	for (unsigned CS : It->second)
+	{
+		CallInst *CI = CG.CallSites[CS];
+		DILocation *Loc = getSourceLocation(CI);
+		if (!pathMatches(Loc->getFilename(), File))
+			continue;
+		for (unsigned FID : CG.callees(CS))
+			Results.push_back(callSiteStr(CI) + " -> " + funcStr(CG.Funcs[FID]));
+	}
+}
+
+void QueryServer::queryCallers(StringRef FuncName,
+		vector<string> &Results)
+{
+	auto It = FuncsByName.find(FuncName);
+	if (It == FuncsByName.end())
+		return;
+
+	CallGraphCSR &CG = Ctx->CG;
+	for (Function *F : It->second)
+	{
+		auto FIt = CG.FuncIDs.find(F);
+		if (FIt == CG.FuncIDs.end())
+			continue;
+		for (unsigned CS : CG.callers(FIt->second))
+			Results.push_back(callSiteStr(CG.CallSites[CS]) + " -> " + funcStr(F));
+	}
+}
+
+bool QueryServer::queryDeps(StringRef ModuleName, StringRef TypeStr,
+		vector<string> &Results, string &Error)
+{
+	Module *M = NULL;
+	for (auto &MN : Ctx->Modules)
+	{
+		if (pathMatches(MN.second, ModuleName))
+		{
+			M = MN.first;
+			break;
+		}
+	}
+	if (!M)
+	{
+		Error = "unknown module";
+		return false;
+	}
+
+	// Named structs must resolve to the types of the module rather
+	// than to new ones
+	SlotMapping Slots;
+	for (StructType *STy : M->getIdentifiedStructTypes())
+		Slots.NamedTypes[STy->getName()] = STy;
+
+	// The parser would create an opaque struct in the context of the
+	// module for any other name, which is never freed
+	string Unknown;
+	if (!typeNamesKnown(TypeStr, Slots, Unknown))
+	{
+		Error = "unknown type %" + Unknown;
+		return false;
+	}
+
+	SMDiagnostic Err;
+	Type *Ty = parseType(TypeStr, Err, *M, &Slots);
+	if (!Ty)
+	{
+		Error = Err.getMessage().str();
+		return false;
+	}
+
+	ModuleSet MSet;
+	CGPass->getDependentModules(M, Ty, MSet);
+	for (unsigned MID : MSet)
+		Results.push_back(Ctx->Modules[MID].second.str());
+	return true;
+}
+
+bool QueryServer::handleQuery(const string &Query, vector<string> &Results,
+		string &Error)
+{
+	StringRef Cmd, Args;
+	std::tie(Cmd, Args) = StringRef(Query).trim().split(' ');
+	Args = Args.trim();
+
+	if (Cmd == "callees")
+	{
+		StringRef File, LineStr;
+		std::tie(File, LineStr) = Args.rsplit(':');
+		unsigned Line;
+		if (File.empty() || LineStr.getAsInteger(10, Line))
+		{
+			Error = "expected <file>:<line>";
+			return false;
+		}
+		queryCallees(File, Line, Results);
+		return true;
+	}
+	else if (Cmd == "callers")
+	{
+		if (Args.empty())
+		{
+			Error = "expected <function>";
+			return false;
+		}
+		queryCallers(Args, Results);
+		return true;
+	}
+	else if (Cmd == "deps")
+	{
+		StringRef ModuleName, TypeStr;
+		std::tie(ModuleName, TypeStr) = Args.split(' ');
+		if (ModuleName.empty() || TypeStr.trim().empty())
+		{
+			Error = "expected <module> <type>";
+			return false;
+		}
+		return queryDeps(ModuleName, TypeStr.trim(), Results, Error);
+	}
+
+	Error = "unknown query";
+	return false;
+}
+
+// Send as much of Out as the client takes without blocking. A client
+// that has gone away fails the send with EPIPE rather than raising
+// SIGPIPE, which would end the server.
+static bool flushOutput(int FD, string &Out)
+{
+	while (!Out.empty())
+	{
+		ssize_t N = send(FD, Out.data(), Out.size(), MSG_NOSIGNAL);
+		if (N < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		Out.erase(0, N);
+	}
+	return true;
+}
+
+// Longest query a client may send; longer ones drop the client
+static const size_t MaxQueryLength = 64 * 1024;
+// Clients served at once; further ones are turned away
+static const size_t MaxClients = 64;
+// Queries of a client are not read while this much of its responses
+// is unsent, which bounds the memory of a client that does not read
+static const size_t MaxPendingOutput = 1 << 20;
+
+// Read what a client has sent and queue the responses to its complete
+// queries. Returns false when the client is to be dropped.
+bool QueryServer::readQueries(Client &C, bool &Shutdown)
+{
+	char Buf[4096];
+	ssize_t N = read(C.FD, Buf, sizeof(Buf));
+	if (N < 0)
+		return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+	if (N == 0)
+	{
+		// Responses still queued are sent before the client is closed
+		C.Closing = true;
+		return true;
+	}
+
+	C.In.append(Buf, N);
+	if (C.In.find('\n') == string::npos && C.In.size() > MaxQueryLength)
+	{
+		C.Out += "ERR query too long\n";
+		C.Closing = true;
+		return true;
+	}
+
+	size_t Pos;
+	while ((Pos = C.In.find('\n')) != string::npos)
+	{
+		string Query = C.In.substr(0, Pos);
+		C.In.erase(0, Pos + 1);
+
+		if (StringRef(Query).trim() == "shutdown")
+		{
+			C.Out += "OK 0\n";
+			Shutdown = true;
+			return true;
+		}
+
+		vector<string> Results;
+		string Error;
+		if (handleQuery(Query, Results, Error))
+		{
+			C.Out += "OK " + to_string(Results.size()) + "\n";
+			for (auto &R : Results)
+				C.Out += R + "\n";
+		}
+		else
+			C.Out += "ERR " + Error + "\n";
+	}
+	return true;
+}
+
+bool QueryServer::run(const string &SocketPath)
+{
+	sockaddr_un Addr;
+	if (SocketPath.size() >= sizeof(Addr.sun_path))
+	{
+		OP << "Socket path is too long: " << SocketPath << "\n";
+		return false;
+	}
+
+	// Only replace a stale socket, never a regular file
+	struct stat St;
+	if (lstat(SocketPath.c_str(), &St) == 0 && S_ISSOCK(St.st_mode))
+		unlink(SocketPath.c_str());
+
+	int SFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (SFD < 0)
+		return false;
+
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sun_family = AF_UNIX;
+	strncpy(Addr.sun_path, SocketPath.c_str(), sizeof(Addr.sun_path) - 1);
+	if (bind(SFD, (sockaddr *)&Addr, sizeof(Addr)) < 0 || listen(SFD, 16) < 0)
+	{
+		OP << "Cannot listen on " << SocketPath << ": "
+		   << strerror(errno) << "\n";
+		close(SFD);
+		return false;
+	}
+	fcntl(SFD, F_SETFL, fcntl(SFD, F_GETFL) | O_NONBLOCK);
+
+	OP << "Serving queries on " << SocketPath << "\n";
+
+	// All clients are served from one poll loop on non-blocking
+	// sockets, so an idle client, or one that does not read its
+	// responses, does not hold up the others
+	vector<Client> Clients;
+	bool Shutdown = false;
+	while (!Shutdown)
+	{
+		vector<pollfd> FDs(1 + Clients.size());
+		FDs[0] = {SFD, POLLIN, 0};
+		for (size_t i = 0; i < Clients.size(); ++i)
+		{
+			Client &C = Clients[i];
+			short Events = 0;
+			if (!C.Closing && C.Out.size() < MaxPendingOutput)
+				Events |= POLLIN;
+			if (!C.Out.empty())
+				Events |= POLLOUT;
+			FDs[i + 1] = {C.FD, Events, 0};
+		}
+
+		if (poll(FDs.data(), FDs.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		// Serve in reverse, so that dropping a client does not move
+		// the ones still to be served
+		for (size_t i = Clients.size(); i > 0 && !Shutdown; --i)
+		{
+			Client &C = Clients[i - 1];
+			short REvents = FDs[i].revents;
+			if (!REvents)
+				continue;
+			bool Keep = !(REvents & POLLNVAL);
+			if (Keep && (FDs[i].events & POLLIN)
+					&& (REvents & (POLLIN | POLLHUP | POLLERR)))
+				Keep = readQueries(C, Shutdown);
+			if (Keep)
+				Keep = flushOutput(C.FD, C.Out);
+			if (Keep && (!C.Closing || !C.Out.empty()))
+				continue;
+			close(C.FD);
+			Clients.erase(Clients.begin() + i - 1);
+		}
+
+		if (Shutdown || !(FDs[0].revents & POLLIN))
+			continue;
+		int CFD = accept(SFD, NULL, NULL);
+		if (CFD < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK
+					|| errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		fcntl(CFD, F_SETFL, fcntl(CFD, F_GETFL) | O_NONBLOCK);
+		if (Clients.size() >= MaxClients)
+		{
+			string Out = "ERR too many clients\n";
+			flushOutput(CFD, Out);
+			close(CFD);
+			continue;
+		}
+		Clients.push_back({CFD, "", "", false});
+	}
+
+	for (Client &C : Clients)
+	{
+		// Answer the shutdown request if the client takes it at once
+		flushOutput(C.FD, C.Out);
+		close(C.FD);
+	}
+	close(SFD);
+	unlink(SocketPath.c_str());
+	return true;
+}
@@ -0,0 +1,56 @@
+#ifndef _QUERY_SERVER_H
+#define _QUERY_SERVER_H
+
+#include "Analyzer.h"
+#include "CallGraph.h"
+
+//
+// Keeps the final analysis state resident and answers queries over a
+// Unix socket. Each request is one line; each response is a line
+// "OK <n>" followed by n result lines, or a line "ERR <message>".
+//
+//   callees <file>:<line>     targets of the calls at a source line
+//   callers <function>        call sites that may call the function
+//   deps <module> <type>      modules the type can flow from into
+//                             the module (type in LLVM syntax)
+//   shutdown                  stop the server
+//
+class QueryServer {
+
+	public:
+		QueryServer(GlobalContext *Ctx_, CallGraphPass *CGPass_);
+
+		// Serve clients until a shutdown request
+		bool run(const string &SocketPath);
+
+	private:
+		GlobalContext *Ctx;
+		CallGraphPass *CGPass;
+
+		// IDs of call sites in Ctx->CG by source line
+		map<unsigned, vector<unsigned>> CallSitesByLine;
+		StringMap<vector<Function *>> FuncsByName;
+
+		// A connected client, with its partial query and the
+		// responses not sent yet
+		struct Client {
+			int FD;
+			string In;
+			string Out;
+			// No more queries are read; closed once Out is sent
+			bool Closing;
+		};
+
+		void buildIndexes();
+		bool readQueries(Client &C, bool &Shutdown);
+		bool handleQuery(const string &Query, vector<string> &Results,
+				string &Error);
+
+		void queryCallees(StringRef File, unsigned Line,
+				vector<string> &Results);
+		void queryCallers(StringRef FuncName, vector<string> &Results);
+		bool queryDeps(StringRef ModuleName, StringRef TypeStr,
+				vector<string> &Results, string &Error);
+};
+
+#endif
@@ -0,0 +1,578 @@
+//===-- Summary.cc - Per-module analysis summaries ---------------===//
+//
+// Serializes the per-module facts of the initialization. Functions
+// and globals are referred to by their index in the module, and
+// types are encoded structurally with identified structs by name,
+// so a summary can be mapped back to a freshly loaded module.
+//
+//===-----------------------------------------------------------===//
+
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include "Config.h"
+#include "Summary.h"
+
+using namespace llvm;
+
+#define SUMMARY_MAGIC 0x4d5553204d505954ULL // "TYPM SUM"
+#define SUMMARY_VERSION 2
+
+enum TypeKind {
+	TK_NamedStruct,
+	TK_LiteralStruct,
+	TK_Pointer,
+	TK_OpaquePointer,
+	TK_Array,
+	TK_Vector,
+	TK_Function,
+	TK_Integer,
+	TK_Primitive,
+};
+
+namespace {
+
+class SummaryWriter {
+
+	public:
+		string Buf;
+		bool Failed = false;
+
+		SummaryWriter(Module *M) {
+			unsigned Idx = 0;
+			for (Function &F : *M)
+				FuncIdx[&F] = Idx++;
+			Idx = 0;
+			for (GlobalVariable &GV : M->globals())
+				GVIdx[&GV] = Idx++;
+		}
+
+		void u8(uint8_t V) {
+			Buf.push_back((char)V);
+		}
+
+		void u32(uint32_t V) {
+			for (int i = 0; i < 4; ++i)
+				u8((V >> (i * 8)) & 0xff);
+		}
+
+		void u64(uint64_t V) {
+			for (int i = 0; i < 8; ++i)
+				u8((V >> (i * 8)) & 0xff);
+		}
+
+		void fp(TypeFP FP) {
+			u64(FP.Lo);
+			u64(FP.Hi);
+		}
+
+		void str(StringRef S) {
+			u32(S.size());
+			Buf.append(S.begin(), S.end());
+		}
+
+		void func(Function *F) {
+			auto It = FuncIdx.find(F);
+			if (It == FuncIdx.end()) {
+				Failed = true;
+				return;
+			}
+			u32(It->second);
+		}
+
+		void global(Value *V) {
+			auto It = GVIdx.find(dyn_cast<GlobalVariable>(V));
+			if (It == GVIdx.end()) {
+				Failed = true;
+				return;
+			}
+			u32(It->second);
+		}
+
+		void funcs(FuncSet &FS) {
+			u32(FS.size());
+			for (auto F : FS)
+				func(F);
+		}
+
+		void type(Type *Ty) {
+			if (StructType *STy = dyn_cast<StructType>(Ty)) {
+				if (!STy->isLiteral()) {
+					// Identified structs are unique by name in a context
+					if (!STy->hasName()) {
+						Failed = true;
+						return;
+					}
+					u8(TK_NamedStruct);
+					str(STy->getName());
+					return;
+				}
+				u8(TK_LiteralStruct);
+				u8(STy->isPacked());
+				u32(STy->getNumElements());
+				for (Type *ETy : STy->elements())
+					type(ETy);
+			}
+			else if (PointerType *PTy = dyn_cast<PointerType>(Ty)) {
+				if (PTy->isOpaque()) {
+					u8(TK_OpaquePointer);
+					u32(PTy->getAddressSpace());
+					return;
+				}
+				u8(TK_Pointer);
+				u32(PTy->getAddressSpace());
+				type(PTy->getPointerElementType());
+			}
+			else if (ArrayType *ATy = dyn_cast<ArrayType>(Ty)) {
+				u8(TK_Array);
+				u64(ATy->getNumElements());
+				type(ATy->getElementType());
+			}
+			else if (VectorType *VTy = dyn_cast<VectorType>(Ty)) {
+				u8(TK_Vector);
+				u8(isa<ScalableVectorType>(VTy));
+				u32(VTy->getElementCount().getKnownMinValue());
+				type(VTy->getElementType());
+			}
+			else if (FunctionType *FTy = dyn_cast<FunctionType>(Ty)) {
+				u8(TK_Function);
+				u8(FTy->isVarArg());
+				type(FTy->getReturnType());
+				u32(FTy->getNumParams());
+				for (Type *PTy : FTy->params())
+					type(PTy);
+			}
+			else if (IntegerType *ITy = dyn_cast<IntegerType>(Ty)) {
+				u8(TK_Integer);
+				u32(ITy->getBitWidth());
+			}
+			else {
+				u8(TK_Primitive);
+				u32(Ty->getTypeID());
+			}
+		}
+
+	private:
+		DenseMap<Function *, unsigned>FuncIdx;
+		DenseMap<GlobalVariable *, unsigned>GVIdx;
+};
+
+class SummaryReader {
+
+	public:
+		bool Failed = false;
+
+		SummaryReader(StringRef Buf_, Module *M)
+			: Buf(Buf_), Ctx(M->getContext()) {
+			for (Function &F : *M)
+				Funcs.push_back(&F);
+			for (GlobalVariable &GV : M->globals())
+				Globals.push_back(&GV);
+		}
+
+		bool atEnd() {
+			return Pos == Buf.size();
+		}
+
+		uint8_t u8() {
+			if (Pos >= Buf.size()) {
+				Failed = true;
+				return 0;
+			}
+			return Buf[Pos++];
+		}
+
+		uint32_t u32() {
+			uint32_t V = 0;
+			for (int i = 0; i < 4; ++i)
+				V |= (uint32_t)u8() << (i * 8);
+			return V;
+		}
+
+		uint64_t u64() {
+			uint64_t V = 0;
+			for (int i = 0; i < 8; ++i)
+				V |= (uint64_t)u8() << (i * 8);
+			return V;
+		}
+
+		TypeFP fp() {
+			TypeFP FP;
+			FP.Lo = u64();
+			FP.Hi = u64();
+			return FP;
+		}
+
+		StringRef str() {
+			uint32_t Len = u32();
+			if (Failed || Len > Buf.size() - Pos) {
+				Failed = true;
+				return "";
+			}
+			StringRef S = Buf.substr(Pos, Len);
+			Pos += Len;
+			return S;
+		}
+
+		// Counts are bounded by the remaining bytes, so a corrupted
+		// count cannot make the reader loop for long
+		uint32_t count() {
+			uint32_t N = u32();
+			if (N > Buf.size() - Pos)
+				Failed = true;
+			return Failed ? 0 : N;
+		}
+
+		Function *func() {
+			uint32_t Idx = u32();
+			if (Idx >= Funcs.size()) {
+				Failed = true;
+				return NULL;
+			}
+			return Funcs[Idx];
+		}
+
+		GlobalVariable *global() {
+			uint32_t Idx = u32();
+			if (Idx >= Globals.size()) {
+				Failed = true;
+				return NULL;
+			}
+			return Globals[Idx];
+		}
+
+		void funcs(FuncSet &FS) {
+			for (uint32_t i = 0, n = count(); i < n; ++i) {
+				if (Function *F = func())
+					FS.insert(F);
+			}
+		}
+
+		Type *type() {
+			if (Failed)
+				return NULL;
+
+			switch (u8()) {
+				case TK_NamedStruct:
+					{
+						Type *Ty = StructType::getTypeByName(Ctx, str());
+						if (!Ty)
+							Failed = true;
+						return Ty;
+					}
+				case TK_LiteralStruct:
+					{
+						bool Packed = u8();
+						vector<Type *> Elems;
+						for (uint32_t i = 0, n = count(); i < n; ++i)
+							Elems.push_back(type());
+						if (Failed)
+							return NULL;
+						return StructType::get(Ctx, Elems, Packed);
+					}
+				case TK_OpaquePointer:
+					return PointerType::get(Ctx, u32());
+				case TK_Pointer:
+					{
+						unsigned AS = u32();
+						Type *ETy = type();
+						if (Failed)
+							return NULL;
+						return PointerType::get(ETy, AS);
+					}
+				case TK_Array:
+					{
+						uint64_t N = u64();
+						Type *ETy = type();
+						if (Failed)
+							return NULL;
+						return ArrayType::get(ETy, N);
+					}
+				case TK_Vector:
+					{
+						bool Scalable = u8();
+						unsigned N = u32();
+						Type *ETy = type();
+						if (Failed)
+							return NULL;
+						return VectorType::get(ETy,
+								ElementCount::get(N, Scalable));
+					}
+				case TK_Function:
+					{
+						bool VarArg = u8();
+						Type *RTy = type();
+						vector<Type *> Params;
+						for (uint32_t i = 0, n = count(); i < n; ++i)
+							Params.push_back(type());
+						if (Failed)
+							return NULL;
+						return FunctionType::get(RTy, Params, VarArg);
+					}
+				case TK_Integer:
+					return IntegerType::get(Ctx, u32());
+				case TK_Primitive:
+					{
+						Type *Ty = Type::getPrimitiveType(Ctx,
+								(Type::TypeID)u32());
+						if (!Ty)
+							Failed = true;
+						return Ty;
+					}
+				default:
+					Failed = true;
+					return NULL;
+			}
+		}
+
+	private:
+		StringRef Buf;
+		size_t Pos = 0;
+		LLVMContext &Ctx;
+		vector<Function *>Funcs;
+		vector<GlobalVariable *>Globals;
+};
+
+}
+
+uint64_t summaryConfigDigest(set<TypeFP> &TTySet) {
+
+	hash<string> str_hash;
+	uint64_t Digest = str_hash("summaryConfigDigest");
+	// Type propagation is only collected for MLTA
+	Digest = Digest * 31 + (ENABLE_MLTA > 1);
+	for (auto TyH : TTySet)
+		Digest = (Digest * 31 + TyH.Lo) * 31 + TyH.Hi;
+
+	// Compile-time options changing the collected facts
+#ifdef SOUND_MODE
+	Digest = Digest * 31 + 1;
+#endif
+#ifdef MLTA_FIELD_INSENSITIVE
+	Digest = Digest * 31 + 2;
+#endif
+#if FUNCTION_AS_TARGET_TYPE
+	Digest = Digest * 31 + 3;
+#endif
+	return Digest;
+}
+
+uint64_t moduleSummaryDigest(Module *M, uint64_t ConfigDigest) {
+
+	return ConfigDigest * 31 + typeHashDigest(M);
+}
+
+string getSummaryPath(const string &Dir, const string &InputFile,
+		uint64_t ConfigDigest) {
+
+	ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+		MemoryBuffer::getFile(InputFile);
+	if (!BufOrErr)
+		return "";
+
+	uint64_t ContentHash = xxHash64((*BufOrErr)->getBuffer());
+	SmallString<256> Path(Dir);
+	sys::path::append(Path, utohexstr(ContentHash) + "-"
+			+ utohexstr(ConfigDigest) + ".sum");
+	return string(Path.str());
+}
+
+bool saveModuleFacts(const string &Path, Module *M, ModuleFacts &MF,
+		uint64_t ConfigDigest) {
+
+	SummaryWriter W(M);
+
+	W.u64(SUMMARY_MAGIC);
+	W.u32(SUMMARY_VERSION);
+	W.u64(ConfigDigest);
+
+	W.u32(MF.typeIdxFuncsMap.size());
+	for (auto &TF : MF.typeIdxFuncsMap) {
+		W.fp(TF.first);
+		W.u32(TF.second.size());
+		for (auto &IF : TF.second) {
+			W.u32(IF.first);
+			W.funcs(IF.second);
+		}
+	}
+
+	W.u32(MF.typeIdxPropMap.size());
+	for (auto &TP : MF.typeIdxPropMap) {
+		W.fp(TP.first);
+		W.u32(TP.second.size());
+		for (auto &IP : TP.second) {
+			W.u32(IP.first);
+			W.u32(IP.second.size());
+			for (auto HI : IP.second) {
+				W.fp(HI.first);
+				W.u32(HI.second);
+			}
+		}
+	}
+
+	W.u32(MF.typeEscapeSet.size());
+	for (auto TyH : MF.typeEscapeSet)
+		W.fp(TyH);
+	W.u32(MF.typeCapSet.size());
+	for (auto TyH : MF.typeCapSet)
+		W.fp(TyH);
+	W.funcs(MF.StoredFuncs);
+
+	W.u32(MF.VTableFuncsMap.size());
+	for (auto &VF : MF.VTableFuncsMap) {
+		W.global(VF.first);
+		W.funcs(VF.second);
+	}
+
+	StoredFieldMap &StoredTypeIdx = MF.storedTypeIdxMap[M];
+	W.u32(StoredTypeIdx.size());
+	for (auto &TI : StoredTypeIdx) {
+		W.type(TI.first);
+		W.u32(TI.second.size());
+		TI.second.forEach([&](int Idx) { W.u32(Idx); });
+	}
+
+	for (auto *CastMap : {&MF.CastFromMap[M], &MF.CastToMap[M]}) {
+		W.u32(CastMap->size());
+		for (auto &CT : *CastMap) {
+			W.type(CT.first);
+			W.u32(CT.second.size());
+			for (Type *Ty : CT.second)
+				W.type(Ty);
+		}
+	}
+
+	W.u32(MF.TargetDataAllocModules.size());
+	for (auto &TA : MF.TargetDataAllocModules)
+		W.fp(TA.first);
+
+	W.u32(MF.AddrTakenFuncs.size());
+	for (auto &AF : MF.AddrTakenFuncs) {
+		W.func(AF.first);
+		W.u64(AF.second);
+	}
+
+	W.u32(MF.CallConfines.size());
+	for (auto &CC : MF.CallConfines) {
+		W.u64(CC.CalleeGUID);
+		W.u32(CC.ArgNo);
+		W.func(CC.F);
+	}
+
+	if (W.Failed)
+		return false;
+
+	// Write to a unique temporary file and rename it, so that
+	// concurrent runs never read a partial summary
+	int FD;
+	SmallString<256> TmpPath;
+	if (sys::fs::createUniqueFile(Path + "-%%%%%%.tmp", FD, TmpPath))
+		return false;
+	{
+		raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		OS << W.Buf;
+		OS.close();
+		if (OS.has_error()) {
+			OS.clear_error();
+			sys::fs::remove(TmpPath);
+			return false;
+		}
+	}
+	if (sys::fs::rename(TmpPath, Path)) {
+		sys::fs::remove(TmpPath);
+		return false;
+	}
+	return true;
+}
+
+bool loadModuleFacts(const string &Path, Module *M, unsigned MID,
+		ModuleFacts &MF, uint64_t ConfigDigest) {
+
+	ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+		MemoryBuffer::getFile(Path);
+	if (!BufOrErr)
+		return false;
+
+	SummaryReader R((*BufOrErr)->getBuffer(), M);
+
+	if (R.u64() != SUMMARY_MAGIC || R.u32() != SUMMARY_VERSION
+			|| R.u64() != ConfigDigest)
+		return false;
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		map<int, FuncSet> &IdxFuncs = MF.typeIdxFuncsMap[R.fp()];
+		for (uint32_t j = 0, m = R.count(); j < m; ++j) {
+			int Idx = R.u32();
+			R.funcs(IdxFuncs[Idx]);
+		}
+	}
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		IdxPropMap &IdxProps = MF.typeIdxPropMap[R.fp()];
+		for (uint32_t j = 0, m = R.count(); j < m; ++j) {
+			HashIdxSet &Props = IdxProps[(int)R.u32()];
+			for (uint32_t k = 0, l = R.count(); k < l; ++k) {
+				TypeFP TyH = R.fp();
+				Props.insert(hashidx_c(TyH, R.u32()));
+			}
+		}
+	}
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i)
+		MF.typeEscapeSet.insert(R.fp());
+	for (uint32_t i = 0, n = R.count(); i < n; ++i)
+		MF.typeCapSet.insert(R.fp());
+	R.funcs(MF.StoredFuncs);
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		GlobalVariable *GV = R.global();
+		FuncSet FS;
+		R.funcs(FS);
+		if (GV)
+			MF.VTableFuncsMap[GV].insert(FS.begin(), FS.end());
+	}
+
+	StoredFieldMap &StoredTypeIdx = MF.storedTypeIdxMap[M];
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		Type *Ty = R.type();
+		for (uint32_t j = 0, m = R.count(); j < m; ++j) {
+			int Idx = R.u32();
+			if (Ty)
+				StoredTypeIdx[Ty].insert(Idx);
+		}
+	}
+
+	for (auto *CastMap : {&MF.CastFromMap[M], &MF.CastToMap[M]}) {
+		for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+			Type *Ty = R.type();
+			for (uint32_t j = 0, m = R.count(); j < m; ++j) {
+				Type *CTy = R.type();
+				if (Ty && CTy)
+					(*CastMap)[Ty].insert(CTy);
+			}
+		}
+	}
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i)
+		MF.TargetDataAllocModules[R.fp()].set(MID);
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		Function *F = R.func();
+		size_t FuncHash = R.u64();
+		MF.AddrTakenFuncs.push_back(make_pair(F, FuncHash));
+	}
+
+	for (uint32_t i = 0, n = R.count(); i < n; ++i) {
+		CallConfine CC;
+		CC.CalleeGUID = R.u64();
+		CC.ArgNo = R.u32();
+		CC.F = R.func();
+		MF.CallConfines.push_back(CC);
+	}
+
+	// A summary that does not fit the module is not used at all
+	return !R.Failed && R.atEnd();
+}
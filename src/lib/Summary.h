@@ -0,0 +1,60 @@
+#ifndef _SUMMARY_H
+#define _SUMMARY_H
+
+#include "Analyzer.h"
+#include "MLTA.h"
+
+//
+// Facts that the initialization extracts from the IR of a single
+// module. They can be saved to a summary file and loaded on later
+// runs instead of walking the IR again.
+//
+struct ModuleFacts {
+
+	// MLTA: type confinement, propagation, and escapes
+	DenseMap<TypeFP, map<int, FuncSet>>typeIdxFuncsMap;
+	DenseMap<TypeFP, IdxPropMap>typeIdxPropMap;
+	DenseSet<TypeFP>typeEscapeSet;
+	DenseSet<TypeFP>typeCapSet;
+	FuncSet StoredFuncs;
+	DenseMap<Value *, FuncSet>VTableFuncsMap;
+
+	// TyPM: stored fields, casts, and allocations
+	DenseMap<Module *, StoredFieldMap> storedTypeIdxMap;
+	DenseMap<Module *, TypeCastMap> CastFromMap;
+	DenseMap<Module *, TypeCastMap> CastToMap;
+	DenseMap<TypeFP, ModuleSet> TargetDataAllocModules;
+
+	// Address-taken functions with their signature hashes
+	vector<pair<Function *, size_t>> AddrTakenFuncs;
+
+	// Confinements through calls to other modules; they depend on
+	// those modules, so they are replayed on every run
+	vector<CallConfine> CallConfines;
+
+	// Structures keyed by IR values; summary files do not hold them,
+	// they are collected from the IR on every run
+	DenseMap<Function *, DenseMap<Value *, Value *>>AliasStructPtrMap;
+	set<StoreInst *>StoreInstSet;
+};
+
+// Digest of the analysis configuration the facts depend on
+uint64_t summaryConfigDigest(set<TypeFP> &TTySet);
+// Digest of what the facts of M depend on besides its IR: the
+// configuration, and the struct names of other modules that the
+// types of M are hashed by. Changes elsewhere in the program leave
+// it as is.
+uint64_t moduleSummaryDigest(Module *M, uint64_t ConfigDigest);
+
+// Path of the summary of M in Dir, keyed by the content of its input
+// file; empty if the file cannot be read
+string getSummaryPath(const string &Dir, const string &InputFile,
+		uint64_t ConfigDigest);
+
+bool saveModuleFacts(const string &Path, Module *M, ModuleFacts &MF,
+		uint64_t ConfigDigest);
+// MID is the ID of M in module sets
+bool loadModuleFacts(const string &Path, Module *M, unsigned MID,
+		ModuleFacts &MF, uint64_t ConfigDigest);
+
+#endif
@@ -32,6 +32,7 @@
 #include <map> 
 #include <vector> 
 #include <iomanip>
+#include <atomic>
 
 
 using namespace llvm;
@@ -39,7 +40,7 @@ using namespace llvm;
 //
 // Static variables
 //
-DenseMap<pair<Module*, size_t>, set<Module*>> TyPM::moPropMapAll;
+DenseMap<pair<Module*, TypeFP>, ModuleSet> TyPM::moPropMapAll;
 
 extern map<Module *, Type *>Int8PtrTy;
 
@@ -57,7 +58,7 @@ bool TyPM::isTargetTy(Type *TTy) {
 	// structs as target types
 
 	if (StructType *STy = dyn_cast<StructType>(TTy)) {
-		size_t TyH = typeHash(STy);
+		TypeFP TyH = typeHash(STy);
 		return (TTySet.find(TyH) != TTySet.end());
 	}
 	return false;
@@ -79,19 +80,56 @@ bool TyPM::isContainerTy(Type *Ty) {
 /////////////////////////////////////////////////////////////////////
 
 
-void TyPM::addPropagation(Module *ToM, Module *FromM, Type *Ty, 
-		bool isICall) {
-	size_t TyH = typeHash(Ty);
+void TyPM::addPropagation(FlowEdges &Flows, Module *ToM, Module *FromM,
+		Type *Ty, bool isICall) {
+	TypeFP TyH = typeHash(Ty);
 #if 0	
 	if (Ty->isFunctionTy())
 		OP<<"@@ FuncType: "<<*Ty<<"; "<<"\n\t"
 			<<FromM->getName()<<" ==> "<<ToM->getName()
 			<<" HASH: "<<TyH<<"\n";
 #endif
-	if (isICall)
-		moPropMapV[make_pair(ToM, TyH)].insert(FromM);
-	else
-		moPropMap[make_pair(ToM, TyH)].insert(FromM);
+	Flows.Edges.push_back(std::make_tuple(moduleID(ToM), TyH,
+				moduleID(FromM), isICall));
+}
+
+bool FlowEdges::beginParsed(const ParsedKey &Key, bool ICall) {
+	if (!(ICall ? ParsedICalls : ParsedDCalls).insert(Key).second)
+		return false;
+	ParsedEdges PE = {Key, ICall, Edges.size(), Edges.size()};
+	Parsed.push_back(PE);
+	return true;
+}
+
+void TyPM::mergeFlows(vector<FlowEdges> &Flows) {
+
+	vector<FlowEdges::Edge> Edges;
+	for (auto &FE : Flows) {
+		// Drop the edges of types that an earlier range has parsed
+		vector<bool> Keep(FE.Edges.size(), true);
+		for (auto &PE : FE.Parsed) {
+			auto &ParsedSet = PE.ICall ? ParsedModuleTypeICallSet
+				: ParsedModuleTypeDCallSet;
+			if (ParsedSet.insert(PE.Key).second)
+				continue;
+			for (size_t i = PE.Begin; i < PE.End; ++i)
+				Keep[i] = false;
+		}
+		for (size_t i = 0; i < FE.Edges.size(); ++i)
+			if (Keep[i])
+				Edges.push_back(FE.Edges[i]);
+	}
+
+	std::sort(Edges.begin(), Edges.end());
+	Edges.erase(std::unique(Edges.begin(), Edges.end()), Edges.end());
+	for (auto &E : Edges) {
+		auto Key = make_pair(Ctx->Modules[std::get<0>(E)].first,
+				std::get<1>(E));
+		if (std::get<3>(E))
+			moPropMapV[Key].set(std::get<2>(E));
+		else
+			moPropMap[Key].set(std::get<2>(E));
+	}
 }
 
 void TyPM::addModuleToGVType(Type *Ty, Module *M, GlobalVariable *GV) {
@@ -101,7 +139,7 @@ void TyPM::addModuleToGVType(Type *Ty, Module *M, GlobalVariable *GV) {
 		<<" <== "<<M->getName()<<" HASH: "<<typeHash(Ty)<<"\n";
 #endif
 	TypesFromModuleGVMap[make_pair(GV->getGUID(), 
-			typeHash(Ty))].insert(M);
+			typeHash(Ty))].set(moduleID(M));
 }
 
 
@@ -112,7 +150,7 @@ void TyPM::addGVToModuleType(Type *Ty, GlobalVariable *GV, Module *M) {
 		<<" ==> "<<M->getName()<<" HASH: "<<typeHash(Ty)<<"\n";
 #endif
 	TypesToModuleGVMap[make_pair(GV->getGUID(), 
-			typeHash(Ty))].insert(M);
+			typeHash(Ty))].set(moduleID(M));
 }
 
 
@@ -131,17 +169,16 @@ void TyPM::findCastsInGV(GlobalVariable * GV,
 	if (!Ini) return;
 	if (!isa<ConstantAggregate>(Ini)) return;
 
-	list<User *>LU;
+	Worklist<User *>LU;
 	LU.push_back(Ini);
-	set<Value *>Visited;
+	VisitedSet<Value *>Visited;
 
 	while (!LU.empty()) {
 		User *U = LU.front();
 		LU.pop_front();
-		if (Visited.find(U) != Visited.end()) {
+		if (!Visited.insert(U)) {
 			continue;
 		}
-		Visited.insert(U);
 
 		for (auto oi = U->op_begin(), oe = U->op_end();
 				oi != oe; ++oi) {
@@ -258,17 +295,16 @@ void TyPM::findTargetTypesInInitializer(GlobalVariable * GV,
 		return;
 	}
 
-	list<User *>LU;
+	Worklist<User *>LU;
 	LU.push_back(Ini);
-	set<Value *>Visited;
+	VisitedSet<Value *>Visited;
 
 	while (!LU.empty()) {
 		User *U = LU.front();
 		LU.pop_front();
-		if (Visited.find(U) != Visited.end()) {
+		if (!Visited.insert(U)) {
 			continue;
 		}
-		Visited.insert(U);
 
 		Type *UTy = U->getType();
 
@@ -283,7 +319,7 @@ void TyPM::findTargetTypesInInitializer(GlobalVariable * GV,
 			// containter type for matching can improve the precision
 			TargetTypes.insert(UTy);
 			// Record allocations
-			TargetDataAllocModules[typeHash(UTy)].insert(M);
+			TargetDataAllocModules[typeHash(UTy)].set(moduleID(M));
 		}
 #endif
 		// Special handling for function pointers and external globals
@@ -305,10 +341,10 @@ void TyPM::findTargetTypesInInitializer(GlobalVariable * GV,
 							EM, ExternalTypes);
 
 					for (auto Ty : ExternalTypes) {
-						size_t TyH = typeHash(Ty);
+						TypeFP TyH = typeHash(Ty);
 						// Must use type hash, as Type * is specific to a module
 						// As this is in initializer, there is no load from the GV
-						moPropMap[make_pair(M, TyH)].insert(EM);
+						moPropMap[make_pair(M, TyH)].set(moduleID(EM));
 					}
 
 				}
@@ -337,7 +373,7 @@ void TyPM::findTargetTypesInInitializer(GlobalVariable * GV,
 					TargetTypes.insert(ETy);
 
 					// Record allocations
-					TargetDataAllocModules[typeHash(UTy)].insert(M);
+					TargetDataAllocModules[typeHash(UTy)].set(moduleID(M));
 
 					if (ETy->isFunctionTy()) {
 						Function *F = dyn_cast<Function>(O);
@@ -393,16 +429,15 @@ bool TyPM::parseUsesOfValue(Value *V, set<Type *> &ReadTypes,
 	return false;
 #endif
 
-	list<Value *>LV;
+	Worklist<Value *>LV;
 	LV.push_back(V);
-	set<Value *>Visited;
+	VisitedSet<Value *>Visited;
 
 	while (!LV.empty()) {
 		Value *CV = LV.front();
 		LV.pop_front();
-		if (Visited.find(CV) != Visited.end())
+		if (!Visited.insert(CV))
 			continue;
-		Visited.insert(CV);
 
 		if (!isa<PointerType>(CV->getType()) && 
 				!CV->getType()->isIntegerTy(64))
@@ -496,18 +531,18 @@ bool TyPM::parseUsesOfValue(Value *V, set<Type *> &ReadTypes,
 						findTargetTypesInValue(CV, TySet, M);
 						Module *CalleeM = CF->getParent();
 						for (auto FTy : TySet) {
-							size_t FTH = typeHash(FTy);
+							TypeFP FTH = typeHash(FTy);
 							if (CI->isIndirectCall()) {
 								if (!CF->onlyWritesMemory())
-									moPropMapV[make_pair(CalleeM, FTH)].insert(M);
+									moPropMapV[make_pair(CalleeM, FTH)].set(moduleID(M));
 								if (!CF->onlyReadsMemory())
-									moPropMapV[make_pair(M, FTH)].insert(CalleeM);
+									moPropMapV[make_pair(M, FTH)].set(moduleID(CalleeM));
 							}
 							else {
 								if (!CF->onlyWritesMemory())
-									moPropMap[make_pair(CalleeM, FTH)].insert(M);
+									moPropMap[make_pair(CalleeM, FTH)].set(moduleID(M));
 								if (!CF->onlyReadsMemory())
-									moPropMap[make_pair(M, FTH)].insert(CalleeM);
+									moPropMap[make_pair(M, FTH)].set(moduleID(CalleeM));
 							}
 						}
 					}
@@ -528,11 +563,10 @@ bool TyPM::parseUsesOfValue(Value *V, set<Type *> &ReadTypes,
 
 // Parse stores and loads against a global
 void TyPM::parseUsesOfGV(GlobalVariable *GV, Value *V, 
-		Module *M, set<Value *> &Visited) {
+		Module *M, VisitedSet<Value *> &Visited) {
 
-	if (Visited.find(V) != Visited.end())
+	if (!Visited.insert(V))
 		return;
-	Visited.insert(V);
 
 	for (User *I : V->users()) {
 
@@ -618,7 +652,7 @@ void TyPM::parseUsesOfGV(GlobalVariable *GV, Value *V,
 #endif
 
 				// TODO: nextLayerBaseType?
-				set<Value *>Visited;
+				VisitedSet<Value *>Visited;
 				Type *BTy = getBaseType(LI->getPointerOperand(), Visited);
 				if (BTy && isContainerTy(BTy)) {
 					addGVToModuleType(BTy, GV, M);
@@ -661,7 +695,8 @@ void TyPM::parseUsesOfGV(GlobalVariable *GV, Value *V,
 }
 
 
-void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
+void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF,
+		FlowEdges &Flows) {
 
 	Module *CallerM = CI->getModule();
 	Module *CalleeM = CF->getParent();
@@ -680,11 +715,11 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 		// Can the arg pass a function pointer? If so which
 		// type?
 		Type *ATy = Arg->getType();
-		size_t HTy = typeHash(ATy);
+		TypeFP HTy = typeHash(ATy);
 
 		// The arg itself is a target type
 		if (isTargetTy(ATy)) {
-			addPropagation(CalleeM, CallerM, ATy, CI->isIndirectCall());
+			addPropagation(Flows, CalleeM, CallerM, ATy, CI->isIndirectCall());
 		}
 		else if (PointerType *PTy = dyn_cast<PointerType>(ATy)){
 			Type *ETy = PTy->getPointerElementType();
@@ -695,14 +730,14 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 				Value *CI_Arg = CI->getArgOperand(AI - CF->arg_begin()); 
 				if (Function *AF = dyn_cast<Function>(CI_Arg)) {
 					if (AF->isDeclaration())
-						AF = Ctx->GlobalFuncMap[AF->getGUID()];
+						AF = Ctx->GlobalFuncMap.lookup(AF->getGUID());
 					if (AF) {
-						addPropagation(CallerM, AF->getParent(), 
+						addPropagation(Flows, CallerM, AF->getParent(), 
 								ETy, CI->isIndirectCall());
 					}
 				}
 
-				addPropagation(CalleeM, CallerM, ETy, CI->isIndirectCall());
+				addPropagation(Flows, CalleeM, CallerM, ETy, CI->isIndirectCall());
 			}
 		}
 
@@ -715,7 +750,7 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 			if (!CF->onlyWritesMemory()) {
 #endif
 				for (auto FTy : ReadTypes) {
-					addPropagation(CalleeM, CallerM, FTy, CI->isIndirectCall());
+					addPropagation(Flows, CalleeM, CallerM, FTy, CI->isIndirectCall());
 				}
 #ifdef FLOW_DIRECTION
 			}
@@ -724,7 +759,7 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 			if (!CF->onlyReadsMemory()) {
 #endif
 				for (auto FTy : WrittenTypes) {
-					addPropagation(CallerM, CalleeM, FTy, CI->isIndirectCall());
+					addPropagation(Flows, CallerM, CalleeM, FTy, CI->isIndirectCall());
 				}
 #ifdef FLOW_DIRECTION
 			}
@@ -734,18 +769,8 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 		else {
 
 			// Avoid repeatation for performance
-			if (CI->isIndirectCall()) {
-				if (ParsedModuleTypeICallMap[MP].find(ATy) 
-						!= ParsedModuleTypeICallMap[MP].end())
-					continue;
-				ParsedModuleTypeICallMap[MP].insert(ATy);
-			}
-			else {
-				if (ParsedModuleTypeDCallMap[MP].find(ATy) 
-						!= ParsedModuleTypeDCallMap[MP].end())
-					continue;
-				ParsedModuleTypeDCallMap[MP].insert(ATy);
-			}
+			if (!Flows.beginParsed(make_pair(MP, ATy), CI->isIndirectCall()))
+				continue;
 
 
 #if 1
@@ -757,7 +782,7 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 #endif
 
 				for (auto FTy : TySet) {
-					addPropagation(CalleeM, CallerM, FTy, CI->isIndirectCall());
+					addPropagation(Flows, CalleeM, CallerM, FTy, CI->isIndirectCall());
 				}
 #ifdef FLOW_DIRECTION
 			}
@@ -769,12 +794,13 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 #endif
 
 				for (auto FTy : TySet) {
-					addPropagation(CallerM, CalleeM, FTy, CI->isIndirectCall());
+					addPropagation(Flows, CallerM, CalleeM, FTy, CI->isIndirectCall());
 				}
 #ifdef FLOW_DIRECTION
 			}
 #endif
 #endif
+			Flows.endParsed();
 		}
 	}
 
@@ -791,7 +817,7 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 		if (!CI->getFunction()->onlyWritesMemory()) {
 #endif
 			for (auto FTy : ReadTypes) {
-				addPropagation(CallerM, CalleeM, FTy, CI->isIndirectCall());
+				addPropagation(Flows, CallerM, CalleeM, FTy, CI->isIndirectCall());
 			}
 #ifdef FLOW_DIRECTION
 		}
@@ -800,7 +826,7 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 		if (!CI->getFunction()->onlyReadsMemory()) {
 #endif
 			for (auto FTy : WrittenTypes) {
-				addPropagation(CalleeM, CallerM, FTy, CI->isIndirectCall());
+				addPropagation(Flows, CalleeM, CallerM, FTy, CI->isIndirectCall());
 			}
 #ifdef FLOW_DIRECTION
 		}
@@ -809,18 +835,8 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 
 	else {
 		// Avoid repeatation for performance
-		if (CI->isIndirectCall()) {
-			if (ParsedModuleTypeICallMap[MP].find(RTy) 
-					!= ParsedModuleTypeICallMap[MP].end())
-				return;
-			ParsedModuleTypeICallMap[MP].insert(RTy);
-		}
-		else {
-			if (ParsedModuleTypeDCallMap[MP].find(RTy) 
-					!= ParsedModuleTypeDCallMap[MP].end())
-				return;
-			ParsedModuleTypeDCallMap[MP].insert(RTy);
-		}
+		if (!Flows.beginParsed(make_pair(MP, RTy), CI->isIndirectCall()))
+			return;
 
 		set<Type *>TySet;
 		findTargetTypesInValue(CI, TySet, CallerM);
@@ -829,18 +845,19 @@ void TyPM::parseTargetTypesInCalls(CallInst *CI, Function *CF) {
 #ifdef FLOW_DIRECTION
 			if (!CI->getFunction()->onlyWritesMemory()) {
 #endif
-				addPropagation(CallerM, CalleeM, FTy, CI->isIndirectCall());
+				addPropagation(Flows, CallerM, CalleeM, FTy, CI->isIndirectCall());
 #ifdef FLOW_DIRECTION
 			}
 #endif
 #ifdef FLOW_DIRECTION
 			else if (!CI->getFunction()->onlyReadsMemory()) {
 #endif
-				addPropagation(CalleeM, CallerM, FTy, CI->isIndirectCall());
+				addPropagation(Flows, CalleeM, CallerM, FTy, CI->isIndirectCall());
 #ifdef FLOW_DIRECTION
 			}
 #endif
 		}
+		Flows.endParsed();
 	}
 }
 
@@ -849,24 +866,27 @@ void TyPM::findTargetTypesInValue(Value *V,
 
 	Type *VTy = V->getType();
 	// Check cached results
-	if (ParsedTypeMap.find(make_pair(M, VTy)) 
-			!= ParsedTypeMap.end()) {
-		TargetTypes = ParsedTypeMap[make_pair(M, VTy)];
+	if (ParsedTypeMap.lookup(make_pair(M, VTy), TargetTypes))
 		return;
-	}
 
-	list<Type *>LT; 
+	Worklist<Type *>LT; 
 	LT.push_back(VTy);
-	set<Type *>Visited;
+	VisitedSet<Type *>Visited;
+	TypeCastMap *CastFrom = NULL, *CastTo = NULL;
+	auto CIt = CastFromMap.find(M);
+	if (CIt != CastFromMap.end())
+		CastFrom = &CIt->second;
+	CIt = CastToMap.find(M);
+	if (CIt != CastToMap.end())
+		CastTo = &CIt->second;
 
 	while (!LT.empty()) {
 		Type *Ty = LT.front();
 		LT.pop_front();
-		if (Visited.find(Ty) != Visited.end()) {
+		if (!Visited.insert(Ty)) {
 			// TODO: Why can this happen?
 			continue;
 		}
-		Visited.insert(Ty);
 
 		// Handle the current type
 		if (isTargetTy(Ty)) {
@@ -893,11 +913,14 @@ void TyPM::findTargetTypesInValue(Value *V,
 
 			// Also track types with cast relation to it
 #if 1
-			for (auto CastTy : CastFromMap[M][Ty]) {
-				LT.push_back(CastTy);
-			}
-			for (auto CastTy : CastToMap[M][Ty]) {
-				LT.push_back(CastTy);
+			for (TypeCastMap *CastMap : {CastFrom, CastTo}) {
+				if (!CastMap)
+					continue;
+				auto TIt = CastMap->find(Ty);
+				if (TIt == CastMap->end())
+					continue;
+				for (auto CastTy : TIt->second)
+					LT.push_back(CastTy);
 			}
 #endif
 		}
@@ -913,7 +936,7 @@ void TyPM::findTargetTypesInValue(Value *V,
 		}
 	}
 
-	ParsedTypeMap[make_pair(M, VTy)] = TargetTypes;
+	ParsedTypeMap.insert(make_pair(M, VTy), TargetTypes);
 	//for (auto FTy : TargetTypes) {
 	//	OP<<*FTy<<"\n";
 	//}
@@ -936,7 +959,7 @@ void TyPM::mapDeclToActualFuncs(FuncSet &FS) {
 		}
 		if (F->isDeclaration()) {
 			FS.erase(F);
-			F = Ctx->GlobalFuncMap[F->getGUID()];
+			F = Ctx->GlobalFuncMap.lookup(F->getGUID());
 			if (F) {
 				FS.insert(F);
 			}
@@ -955,7 +978,7 @@ void TyPM::findTargetAllocInFunction(Function * F) {
 		if (AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
 			Type *Ty = AI->getAllocatedType();
 			if (isTargetTy(Ty)) {
-				TargetDataAllocModules[typeHash(Ty)].insert(F->getParent());
+				TargetDataAllocModules[typeHash(Ty)].set(moduleID(F->getParent()));
 			}
 		}
 	}
@@ -985,7 +1008,7 @@ void TyPM::findStoredTypeIdxInFunction(Function * F) {
 				storedTypeIdxMap[F->getParent()][TI.first].insert(TI.second);
 				continue;
 			}
-			set<Value *>Visited;
+			VisitedSet<Value *>Visited;
 			Type *BTy = getBaseType(PO, Visited);
 			if (BTy) {
 				storedTypeIdxMap[F->getParent()][BTy].insert(0);
@@ -997,24 +1020,142 @@ void TyPM::findStoredTypeIdxInFunction(Function * F) {
 
 
 
+void TyPM::swapModuleFacts(ModuleFacts &MF) {
+
+	std::swap(typeIdxFuncsMap, MF.typeIdxFuncsMap);
+	std::swap(typeIdxPropMap, MF.typeIdxPropMap);
+	std::swap(typeEscapeSet, MF.typeEscapeSet);
+	std::swap(typeCapSet, MF.typeCapSet);
+	std::swap(StoredFuncs, MF.StoredFuncs);
+	std::swap(VTableFuncsMap, MF.VTableFuncsMap);
+	std::swap(storedTypeIdxMap, MF.storedTypeIdxMap);
+	std::swap(CastFromMap, MF.CastFromMap);
+	std::swap(CastToMap, MF.CastToMap);
+	std::swap(TargetDataAllocModules, MF.TargetDataAllocModules);
+	std::swap(AliasStructPtrMap, MF.AliasStructPtrMap);
+	std::swap(StoreInstSet, MF.StoreInstSet);
+}
+
+void TyPM::collectModuleFacts(Module *M, ModuleFacts &MF) {
+
+	swapModuleFacts(MF);
+	DeferredCallConfines = &MF.CallConfines;
+
+	set<User *> CastSet;
+
+	for (Module::global_iterator gi = M->global_begin();
+			gi != M->global_end(); ++gi) {
+
+		GlobalVariable *GV = &*gi;
+		if (!GV->hasInitializer())
+			continue;
+
+		Type *ITy = GV->getInitializer()->getType();
+		if (!ITy->isPointerTy() && !isContainerTy(ITy))
+			continue;
+
+		typeConfineInInitializer(GV);
+
+		// Collect all casts in the global variable
+		findCastsInGV(GV, CastSet);
+	}
+
+	bool HasBody = false;
+	for (Function &F : *M) {
+
+		// Do not include LLVM intrinsic functions?
+		if (F.isIntrinsic()) {
+			continue;
+		}
+
+		// Collect address-taken functions.
+		// NOTE: declaration functions can also have address taken
+		if (F.hasAddressTaken()) {
+			MF.AddrTakenFuncs.push_back(make_pair(&F, funcHash(&F, false)));
+		}
+
+		if (F.isDeclaration()) {
+			continue;
+		}
+		HasBody = true;
+
+		//
+		// MLTA and TyPM
+		//
+		if (ENABLE_MLTA > 1) {
+			typePropInFunction(&F);
+		}
+
+		collectAliasStructPtr(&F);
+		typeConfineInFunction(&F);
+
+		// Collect all casts in the function
+		findCastsInFunction(&F, CastSet);
+
+		// Collect all stores against fields of composite types in the
+		// function
+		findStoredTypeIdxInFunction(&F);
+
+		// Collection allocations of critical data structures
+		findTargetAllocInFunction(&F);
+	}
+
+	// Handle casts; casts of globals only count in modules with
+	// function bodies
+	if (HasBody)
+		processCasts(CastSet, M);
+
+	DeferredCallConfines = NULL;
+	swapModuleFacts(MF);
+}
+
+void TyPM::collectIRFacts(Module *M, ModuleFacts &MF) {
+
+	swapModuleFacts(MF);
+	for (Function &F : *M) {
+		if (F.isDeclaration())
+			continue;
+		collectAliasStructPtr(&F);
+		for (inst_iterator i = inst_begin(F), e = inst_end(F);
+				i != e; ++i) {
+			if (StoreInst *SI = dyn_cast<StoreInst>(&*i))
+				StoreInstSet.insert(SI);
+		}
+	}
+	swapModuleFacts(MF);
+}
+
+
+
 /////////////////////////////////////////////////////////////////////
 //
 // The following are APIs for resolving dependent modules and targets
 //
 /////////////////////////////////////////////////////////////////////
 
+const FieldSet *TyPM::storedFields(Module *M, Type *Ty) {
+
+	auto MIt = storedTypeIdxMap.find(M);
+	if (MIt == storedTypeIdxMap.end())
+		return NULL;
+	auto TIt = MIt->second.find(Ty);
+	if (TIt == MIt->second.end())
+		return NULL;
+	return &TIt->second;
+}
+
 void TyPM::getDependentModulesV(Value* TV, Module *M,
-		set<Module *> &MSet) {
+		ModuleSet &MSet, raw_ostream &OS) {
 
 	Type *Ty = TV->getType();
 
 	// Get the outermost layer type
 	list<typeidx_t> TyList;
 	Value *CV = TV, *NextV;
-	set<Value*> Visited;
+	VisitedSet<Value *> Visited;
 	while (nextLayerBaseTypeWL(CV, TyList, NextV)) {
 		Visited.insert(CV);
-		if (Visited.find(NextV) != Visited.end()) {
+		if (Visited.count(NextV)) {
 			break;
 		}
 		CV = NextV;
@@ -1039,11 +1180,8 @@ void TyPM::getDependentModulesV(Value* TV, Module *M,
 		// negatives
 		//
 		// Externality check
-		if (storedTypeIdxMap[M].find(TyIdx.first) 
-				!= storedTypeIdxMap[M].end()) {
-			if ((storedTypeIdxMap[M][TyIdx.first].find(TyIdx.second)
-						!= storedTypeIdxMap[M][TyIdx.first].end())
-					|| TyIdx.second == -1)
+		if (const FieldSet *Fields = storedFields(M, TyIdx.first)) {
+			if (Fields->count(TyIdx.second) || TyIdx.second == -1)
 				break;
 		}
 		Outermost = TyIdx;
@@ -1057,8 +1195,8 @@ void TyPM::getDependentModulesV(Value* TV, Module *M,
 	Type *TTy = Ty;
 	if (Outermost.first) {
 		TTy = Outermost.first;
-		OP<<"@@ Elevated type: "<<*(Ty)<<" ==> "<<*(TTy)<<"\n";
-		OP<<"@@ Field index: "<<Outermost.second<<"\n";
+		OS<<"@@ Elevated type: "<<*(Ty)<<" ==> "<<*(TTy)<<"\n";
+		OS<<"@@ Field index: "<<Outermost.second<<"\n";
 		while (TTy->isPointerTy())
 			TTy = TTy->getPointerElementType();
 	}
@@ -1067,83 +1205,247 @@ void TyPM::getDependentModulesV(Value* TV, Module *M,
 			TTy = TTy->getPointerElementType();
 	}
 
-	auto TyM = make_pair(M, typeHash(TTy));
-	if (ResolvedDepModulesMap.find(TyM)
-			!= ResolvedDepModulesMap.end())
-		MSet = ResolvedDepModulesMap[TyM];
-	else {
-		getDependentModulesTy(typeHash(TTy), M, MSet);
-		ResolvedDepModulesMap[TyM] = MSet;
-	}
-	if (MSet.size() == 0 && isContainerTy(TTy)) {
-		if (storedTypeIdxMap[M].find(TTy) == storedTypeIdxMap[M].end()) {
-			set<Module *> &MSet = TargetDataAllocModules[typeHash(TTy)];
-			if (MSet.find(M) == MSet.end()) {
-				OP<<"!!! NO DEPENDENCE: "<<*TTy<<"\n";
-				printSourceCodeInfo(TV, "TYPE-ERR");
+	getDependentModulesTy(typeHash(TTy), M, MSet);
+	if (MSet.empty() && isContainerTy(TTy)) {
+		if (!storedFields(M, TTy)) {
+			auto It = TargetDataAllocModules.find(typeHash(TTy));
+			if (It == TargetDataAllocModules.end()
+					|| !It->second.test(moduleID(M))) {
+				OS<<"!!! NO DEPENDENCE: "<<*TTy<<"\n";
+				printSourceCodeInfo(TV, "TYPE-ERR", "", OS);
 			}
 		}
 	}
 }
 
 
-void TyPM::getDependentModulesTy(size_t TyH, Module *M,
-		set<Module *> &MSet) {
+void TyPM::getDependentModulesTy(TypeFP TyH, Module *M,
+		ModuleSet &MSet) {
 
 	//
 	// Resolving dependent modules for M
 	//
 
-	set<Module *> PM;
-	list<Module *> EM;
-	EM.push_back(M);
+	const DepClosure &DC = getDependenceClosure(TyH);
+	auto It = DC.SCCOf.find(moduleID(M));
+	if (It != DC.SCCOf.end())
+		MSet |= DC.SCCDeps[It->second];
+}
 
-	while (!EM.empty()) {
-		Module *TM = EM.front();
-		EM.pop_front();
-		// To test the presence of an element - find() in set, count() in multiset
-		if (PM.find(TM) != PM.end())
+void TyPM::resetDependenceClosures() {
+
+	DepClosureMap.clear();
+	PropEdgesByType.clear();
+	ClosureArena.DestroyAll();
+	EdgeArena.Reset();
+
+	// The edges of a type take one array of the arena
+	DenseMap<TypeFP, pair<unsigned, PropEdge *>> Slots;
+	for (auto &P : moPropMapAll)
+		if (!P.second.empty())
+			++Slots[P.first.second].first;
+	for (auto &S : Slots) {
+		S.second.second = EdgeArena.Allocate<PropEdge>(S.second.first);
+		PropEdgesByType[S.first] =
+			makeArrayRef(S.second.second, S.second.first);
+	}
+	for (auto &P : moPropMapAll) {
+		if (P.second.empty())
 			continue;
-		PM.insert(TM);
+		new (Slots[P.first.second].second++)
+			PropEdge(moduleID(P.first.first), &P.second);
+	}
+}
 
-		for (auto m : moPropMapAll[make_pair(TM, TyH)]) {
-			MSet.insert(m);
-			EM.push_back(m);
-		}
+const TyPM::DepClosure &TyPM::getDependenceClosure(TypeFP TyH) {
 
-		// Handling transitioning modules that can pass function
-		// poitners, although there is no function type
-		for (auto m : moPropMapAll[make_pair(TM, typeHash(Int8PtrTy[TM]))]) {
-			// Simply continue to search related modules
-			EM.push_back(m);
+	{
+		std::lock_guard<std::mutex> Guard(DepClosureLock);
+		auto CIt = DepClosureMap.find(TyH);
+		if (CIt != DepClosureMap.end())
+			return *CIt->second;
+	}
+	// Computed without the lock; a thread that loses the race to add
+	// the closure of TyH drops its copy, which is the same
+	DepClosure DC;
+
+	// The dependent modules of M are the targets of the TyH edges
+	// of all modules reachable from M, where modules are also
+	// reached through general pointers (i8*) that can pass
+	// function pointers, although there is no function type
+	DenseMap<unsigned, const ModuleSet *> TyEdges, Edges;
+	vector<std::unique_ptr<ModuleSet>> MergedEdges;
+	auto EIt = PropEdgesByType.find(TyH);
+	if (EIt != PropEdgesByType.end()) {
+		for (auto &E : EIt->second) {
+			TyEdges[E.first] = E.second;
+			Edges[E.first] = E.second;
+		}
+	}
+	if (!Int8PtrTy.empty()) {
+		TypeFP I8H = typeHash(Int8PtrTy.begin()->second);
+		EIt = PropEdgesByType.find(I8H);
+		if (I8H != TyH && EIt != PropEdgesByType.end()) {
+			for (auto &E : EIt->second) {
+				const ModuleSet *&Succ = Edges[E.first];
+				if (!Succ) {
+					Succ = E.second;
+					continue;
+				}
+				// Modules with both kinds of edges get a merged set
+				ModuleSet *Merged = new ModuleSet(*Succ);
+				*Merged |= *E.second;
+				MergedEdges.emplace_back(Merged);
+				Succ = Merged;
+			}
 		}
+	}
 
+	//
+	// Tarjan's algorithm. SCCs are completed in reverse topological
+	// order, so the sets of successor SCCs are final when an SCC is
+	// completed.
+	//
+	struct Frame {
+		unsigned M;
+		vector<unsigned> Succs;
+		size_t Next;
+	};
+	DenseMap<unsigned, unsigned> Index, LowLink;
+	vector<unsigned> Stack;
+	DenseSet<unsigned> OnStack;
+	vector<Frame> Frames;
+
+	auto Push = [&](unsigned M) {
+		unsigned I = Index.size();
+		Index[M] = I;
+		LowLink[M] = I;
+		Stack.push_back(M);
+		OnStack.insert(M);
+		Frame F = {M, {}, 0};
+		auto It = Edges.find(M);
+		if (It != Edges.end())
+			for (unsigned S : *It->second)
+				F.Succs.push_back(S);
+		Frames.push_back(std::move(F));
+	};
+
+	for (auto &E : Edges) {
+		if (Index.count(E.first))
+			continue;
+
+		Push(E.first);
+		while (!Frames.empty()) {
+			Frame &F = Frames.back();
+			if (F.Next < F.Succs.size()) {
+				unsigned S = F.Succs[F.Next++];
+				// Modules without edges add nothing
+				if (!Edges.count(S))
+					continue;
+				if (!Index.count(S))
+					Push(S);
+				else if (OnStack.count(S))
+					LowLink[F.M] = std::min(LowLink[F.M], Index[S]);
+				continue;
+			}
+
+			unsigned M = F.M;
+			if (LowLink[M] == Index[M]) {
+				unsigned SCC = DC.SCCDeps.size();
+				vector<unsigned> Members;
+				unsigned V;
+				do {
+					V = Stack.back();
+					Stack.pop_back();
+					OnStack.erase(V);
+					DC.SCCOf[V] = SCC;
+					Members.push_back(V);
+				} while (V != M);
+
+				ModuleSet Deps;
+				for (unsigned V : Members) {
+					auto TIt = TyEdges.find(V);
+					if (TIt != TyEdges.end())
+						Deps |= *TIt->second;
+					for (unsigned S : *Edges[V]) {
+						auto SIt = DC.SCCOf.find(S);
+						if (SIt != DC.SCCOf.end() && SIt->second != SCC)
+							Deps |= DC.SCCDeps[SIt->second];
+					}
+				}
+				DC.SCCDeps.push_back(std::move(Deps));
+			}
+
+			Frames.pop_back();
+			if (!Frames.empty()) {
+				unsigned P = Frames.back().M;
+				LowLink[P] = std::min(LowLink[P], LowLink[M]);
+			}
+		}
 	}
+
+	std::lock_guard<std::mutex> Guard(DepClosureLock);
+	auto &Slot = DepClosureMap[TyH];
+	if (!Slot)
+		Slot = new (ClosureArena.Allocate()) DepClosure(std::move(DC));
+	return *Slot;
+}
+
+void CallSiteTable::add(CallInst *CI, unsigned MID, size_t SigHash) {
+
+	bool Indirect = CI->isIndirectCall();
+	if (Indirect)
+		IndirectIDs.push_back(Insts.size());
+	Insts.push_back(CI);
+	ModuleIDs.push_back(MID);
+	SigHashes.push_back(SigHash);
+	CalledOperands.push_back(CI->getCalledOperand());
+	NumArgs.push_back(CI->arg_size());
+	IsIndirect.push_back(Indirect);
+}
+
+void CallSiteTable::finish(CalleeMap &Callees, unsigned NumModules) {
+
+	CalleeSlots.resize(Insts.size());
+	for (size_t CS = 0; CS < Insts.size(); ++CS)
+		CalleeSlots[CS] = &Callees[Insts[CS]];
+
+	// Rows are added module by module
+	ModuleBegin.assign(NumModules + 1, 0);
+	for (unsigned MID : ModuleIDs)
+		++ModuleBegin[MID + 1];
+	for (unsigned i = 1; i <= NumModules; ++i)
+		ModuleBegin[i] += ModuleBegin[i - 1];
 }
 
 bool TyPM::resolveFunctionTargets() {
 
-	uint64_t oldCount = 0, newCount = 0, outScopeCount = 0;
-	uint64_t oldModuleCount = 0, newModuleCount = 0;
+	// Updated by the threads resolving call sites
+	std::atomic<uint64_t> oldCount(0), newCount(0), outScopeCount(0);
+	std::atomic<uint64_t> oldModuleCount(0), newModuleCount(0);
 
-	for (auto CI : ICallSet) {
+	// The call sites are pruned independently: moPropMapAll does not
+	// change in this step, and each call site has its own callee slot
+	auto resolveCallSite = [&](unsigned CS, raw_ostream &OS) {
 
-		oldCount += Ctx->Callees[CI].size();
+		// Callee sets are shared, so work on a copy
+		FuncSet Callees = *CallSites.callees(CS);
+		oldCount += Callees.size();
 		oldModuleCount += Ctx->Modules.size();
-		Module *CallerM = CI->getModule();
-		CallBase *CB = dyn_cast<CallBase>(CI);
-		Type *FuncType = CB->getFunctionType(); 
-		set<Module *> MSet;
-		getDependentModulesV(CI->getCalledOperand(), CallerM, MSet); 
-		MSet.insert(CallerM);
-		newModuleCount += MSet.size();
+		unsigned CallerMID = CallSites.ModuleIDs[CS];
+		Module *CallerM = Ctx->Modules[CallerMID].first;
+		ModuleSet MSet;
+		getDependentModulesV(CallSites.CalledOperands[CS], CallerM, MSet,
+				OS);
+		MSet.set(CallerMID);
+		newModuleCount += MSet.count();
 
 #ifdef PRINT_ICALL_TARGET_ON_THE_FLY
-		printSourceCodeInfo(CI, "RESOLVING");
+		printSourceCodeInfo(CallSites.Insts[CS], "RESOLVING", "", OS);
 #endif
-		for (auto Callee : Ctx->Callees[CI]) {
+		for (auto Callee : Callees) {
 			Module *CalleeM = Callee->getParent();
-			if (MSet.find(CalleeM) != MSet.end()) {
+			if (MSet.test(moduleID(CalleeM))) {
 				newCount += 1;
 			}
 			else {
@@ -1155,7 +1457,7 @@ bool TyPM::resolveFunctionTargets() {
 						//&& (StoredFuncs.find(Callee) != StoredFuncs.end())
 				   ) {
 
-					Ctx->Callees[CI].erase(Callee);
+					Callees.erase(Callee);
 #ifdef PRINT_ICALL_TARGET_ON_THE_FLY
 					printSourceCodeInfo(Callee, "REMOVED");
 #endif
@@ -1165,11 +1467,28 @@ bool TyPM::resolveFunctionTargets() {
 				}
 			}
 		}
-		mapDeclToActualFuncs(Ctx->Callees[CI]);
+		mapDeclToActualFuncs(Callees);
+		CallSites.callees(CS) = Ctx->CalleeSets.intern(Callees);
+	};
+
+	// With several jobs, the diagnostics of each call site are kept
+	// and printed in call-site order afterwards
+	size_t NumICalls = CallSites.IndirectIDs.size();
+	vector<string> Logs(ANALYSIS_JOBS == 1 ? 0 : NumICalls);
+	parallelFor(ANALYSIS_JOBS, NumICalls, [&](size_t i) {
+		if (Logs.empty()) {
+			resolveCallSite(CallSites.IndirectIDs[i], OP);
+			return;
+		}
+		raw_string_ostream OS(Logs[i]);
+		resolveCallSite(CallSites.IndirectIDs[i], OS);
+	});
+	for (auto &Log : Logs)
+		OP<<Log;
 #ifdef PRINT_ICALL_TARGET_ON_THE_FLY
-		printTargets(Ctx->Callees[CI], CI);
+	for (unsigned CS : CallSites.IndirectIDs)
+		printTargets(*CallSites.callees(CS), CallSites.Insts[CS]);
 #endif
-	}
 	if (Ctx->NumIndirectCallTargets > 0) {
 		time_t my_time = time(NULL);
 		OP<<"# TIME: "<<ctime(&my_time)<<"\n";
@@ -1198,18 +1517,28 @@ bool TyPM::resolveStructTargets() {
 	uint64_t oldCount = 0, newCount = 0, totalCount = 0;
 	int criticalWrites = 0;
 
-	int Progress = 0;
-	for (auto SI : StoreInstSet) {
-		++Progress;
-
-		bool criticalType = false;
-		Value *PO = SI->getPointerOperand();
+	//
+	// Find the critical type of each store on ANALYSIS_JOBS threads.
+	// Stores to the same critical type in a module have the same
+	// dependent modules, so these are resolved once per group.
+	//
+	vector<StoreInst *> Stores(StoreInstSet.begin(), StoreInstSet.end());
+	vector<TypeFP> CriticalTypes(Stores.size());
+	vector<char> IsCritical(Stores.size(), 0);
+	// Report the progress about once per percent; raw_ostream is not
+	// thread-safe, so the reports are serialized
+	size_t Step = std::max<size_t>(1, Stores.size() / 100);
+	std::atomic<size_t> Progress(0);
+	std::mutex ProgressLock;
+	parallelFor(ANALYSIS_JOBS, Stores.size(), [&](size_t i) {
+
+		Value *PO = Stores[i]->getPointerOperand();
 		list<typeidx_t> TyList;
 		Value *CV = PO, *NextV;
-		set<Value*> Visited;
+		VisitedSet<Value *> Visited;
 		while (nextLayerBaseTypeWL(CV, TyList, NextV)) {
 			Visited.insert(CV);
-			if (Visited.find(NextV) != Visited.end()) {
+			if (Visited.count(NextV)) {
 				break;
 			}
 			CV = NextV;
@@ -1218,74 +1547,58 @@ bool TyPM::resolveStructTargets() {
 		for (auto TyIdx : TyList) {
 			if (isTargetTy(TyIdx.first)) {
 				TTy = TyIdx.first;
-				criticalType = true;
 				break;
 			}
 		}
 		if (!TTy) {
-			set<Value *>Visited;
+			VisitedSet<Value *>Visited;
 			TTy = getBaseType(PO, Visited);
-			if (TTy && isTargetTy(TTy)) {
-				criticalType = true;
-			}
+			if (TTy && !isTargetTy(TTy))
+				TTy = NULL;
 		}
-		if ((PO->getType() != Int8PtrTy[SI->getModule()]) 
-				&& !criticalType)
-			continue;
-
-		// the remaining writes target either critical structures or
-		// general pointers.
-		// now, further resolve the dependences for them
-
-		if (criticalType) {
-
-			totalCount += Ctx->Modules.size();
-
-			size_t TyH = typeHash(TTy);
-
-			// Resolving dependences for TTy
-			set<Module *>MSet;
-			getDependentModulesTy(TyH, SI->getModule(), MSet);
-			if (MSet.size() == 0)
-				continue;
-			for (auto tyh : TargetDataAllocModules[TyH]) {
-				++oldCount;
-				// Matched
-				if (MSet.find(tyh) != MSet.end()) {
-					++newCount;
-				}
-			}
+		// Writes through general pointers may also target critical
+		// structures; they are not resolved for now
+		if (TTy) {
+			CriticalTypes[i] = typeHash(TTy);
+			IsCritical[i] = 1;
 		}
 
-		// the following assumes that general pointer may also target
-		// critical data structures and goes ahead to resove
-		// dependences
-#if 0
-		else {
-			totalCount += Ctx->Modules.size();
-			for (size_t TyH : TTySet) {
-				// Resolving dependences for TTy
-				set<Module *>MSet;
-				getDependentModules(TyH, SI->getModule(), MSet);
-				if (MSet.size() == 0)
-					continue;
-				for (auto tyh : TargetDataAllocModules[TyH]) {
-					++oldCount;
-					// Matched
-					if (MSet.find(tyh) != MSet.end()) {
-						++newCount;
-						criticalType = true;
-					}
-				}
-				if (criticalType)
-					break;
-			}
+		size_t Done = ++Progress;
+		if (Done % Step == 0 || Done == Stores.size()) {
+			std::lock_guard<std::mutex> Guard(ProgressLock);
+			OP<<Done<<" / "<<Stores.size()<<"\n";
 		}
-#endif
-		if (criticalType)
-			++criticalWrites;
-
-		OP<<Progress<<" / "<<StoreInstSet.size()<<"\n";
+	});
+
+	// Number of stores by module ID and critical type
+	map<pair<unsigned, TypeFP>, unsigned> GroupSizes;
+	for (size_t i = 0; i < Stores.size(); ++i) {
+		if (IsCritical[i])
+			++GroupSizes[make_pair(moduleID(Stores[i]->getModule()),
+					CriticalTypes[i])];
+	}
+	vector<pair<pair<unsigned, TypeFP>, unsigned>> Groups(
+			GroupSizes.begin(), GroupSizes.end());
+
+	// Resolving dependences for the critical types
+	vector<ModuleSet> Deps(Groups.size());
+	parallelFor(ANALYSIS_JOBS, Groups.size(), [&](size_t g) {
+		Module *M = Ctx->Modules[Groups[g].first.first].first;
+		getDependentModulesTy(Groups[g].first.second, M, Deps[g]);
+	});
+
+	for (size_t g = 0; g < Groups.size(); ++g) {
+		unsigned NumStores = Groups[g].second;
+		totalCount += NumStores * Ctx->Modules.size();
+		if (Deps[g].empty())
+			continue;
+		auto It = TargetDataAllocModules.find(Groups[g].first.second);
+		if (It != TargetDataAllocModules.end()) {
+			oldCount += NumStores * It->second.count();
+			// Matched
+			newCount += NumStores * (It->second & Deps[g]).count();
+		}
+		criticalWrites += NumStores;
 	}
 
 	time_t my_time = time(NULL);
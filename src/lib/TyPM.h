@@ -4,7 +4,69 @@
 #include "Analyzer.h"
 #include "MLTA.h"
 #include "Config.h"
+#include "Summary.h"
+#include "llvm/Support/Allocator.h"
+
+
+//
+// Call sites of the analyzed functions as parallel arrays indexed by
+// call-site ID. The table is filled by phase 1, which walks the IR
+// anyway; later phases iterate it instead of the IR. The rows of a
+// module are contiguous and in instruction order.
+//
+struct CallSiteTable {
+	vector<CallInst *> Insts;
+	vector<unsigned> ModuleIDs;
+	// callHash() of indirect calls; 0 for direct calls
+	vector<size_t> SigHashes;
+	vector<Value *> CalledOperands;
+	vector<unsigned> NumArgs;
+	// Entries of Ctx->Callees, bound once phase 1 is done; no call
+	// site is added to Callees after that
+	vector<const FuncSet **> CalleeSlots;
+	vector<bool> IsIndirect;
+	// IDs of the indirect calls
+	vector<unsigned> IndirectIDs;
+	// First row of each module by module ID, followed by the end
+	vector<unsigned> ModuleBegin;
+
+	size_t size() const { return Insts.size(); }
+	const FuncSet *&callees(unsigned CS) { return *CalleeSlots[CS]; }
+
+	void add(CallInst *CI, unsigned MID, size_t SigHash);
+	// Done with phase 1
+	void finish(CalleeMap &Callees, unsigned NumModules);
+};
 
+//
+// Edges of the propagation maps found by parsing the calls of a range
+// of call sites, so that ranges can be parsed on different threads
+// and merged in order.
+//
+struct FlowEdges {
+	// To module ID, type, from module ID, and whether the flow is
+	// through an indirect call
+	typedef std::tuple<unsigned, TypeFP, unsigned, bool> Edge;
+	typedef pair<pair<Module *, Module *>, Type *> ParsedKey;
+
+	// Edges from parsing a type for calls between two modules, which
+	// is done once per phase: only the first range in call-site order
+	// that parses the type keeps them
+	struct ParsedEdges {
+		ParsedKey Key;
+		bool ICall;
+		size_t Begin, End;
+	};
+
+	vector<Edge> Edges;
+	vector<ParsedEdges> Parsed;
+	DenseSet<ParsedKey> ParsedICalls, ParsedDCalls;
+
+	// False if the range has parsed Key already; otherwise the edges
+	// added until endParsed() belong to Key
+	bool beginParsed(const ParsedKey &Key, bool ICall);
+	void endParsed() { Parsed.back().End = Edges.size(); }
+};
 
 class TyPM : public MLTA {
 
@@ -15,9 +77,7 @@ class TyPM : public MLTA {
 		// 
 
 		//GlobalContext *Ctx;
-		set<CallInst *>CallSet;
-		set<CallInst *>ICallSet;
-		set<CallInst *>MatchedICallSet;
+		CallSiteTable CallSites;
 		set<StoreInst *>StoreInstSet;
 
 
@@ -26,38 +86,39 @@ class TyPM : public MLTA {
 		// 
 
 		// Set of target types
-		set<size_t>TTySet;
-		DenseMap<size_t, set<Module *>> TargetDataAllocModules;
+		set<TypeFP>TTySet;
+		DenseMap<TypeFP, ModuleSet> TargetDataAllocModules;
 
 		set<string> OutScopeFuncNames;
 
 		// Propagation maps
-		DenseMap<Module*, set<map<Module*, set<size_t>>>>moTyPropMap;
-		DenseMap<pair<Module*, size_t>, set<Module*>>moPropMap;
+		DenseMap<Module*, set<map<Module*, set<TypeFP>>>>moTyPropMap;
+		DenseMap<pair<Module*, TypeFP>, ModuleSet>moPropMap;
 		// Versatile map for refined indirect calls
-		DenseMap<pair<Module*, size_t>, set<Module*>>moPropMapV;
+		DenseMap<pair<Module*, TypeFP>, ModuleSet>moPropMapV;
 
 		// Which fields of a type have been stored to
-		DenseMap<Module *, map<Type *, set<int>>> storedTypeIdxMap;
+		DenseMap<Module *, StoredFieldMap> storedTypeIdxMap;
 
 		// All casts in a module
-		DenseMap<Module *, map<Type *, set<Type *>>> CastFromMap;
-		DenseMap<Module *, map<Type *, set<Type *>>> CastToMap;
+		DenseMap<Module *, TypeCastMap> CastFromMap;
+		DenseMap<Module *, TypeCastMap> CastToMap;
 
 		// Function types that can be held by the GV
 		DenseMap<GlobalVariable *, set<Type *>>GVFuncTypesMap;
 		// Modules that store function pointers of the type to the global
-		DenseMap<pair<uint64_t, size_t>, set<Module *>>TypesFromModuleGVMap;
+		DenseMap<pair<uint64_t, TypeFP>, ModuleSet>TypesFromModuleGVMap;
 		// Modules that load function pointers of the type from the global
-		DenseMap<pair<uint64_t, size_t>, set<Module *>>TypesToModuleGVMap;
+		DenseMap<pair<uint64_t, TypeFP>, ModuleSet>TypesToModuleGVMap;
 
 		// For caching
-		DenseMap<size_t, FuncSet> MatchedICallTypeMap;
-		DenseMap<pair<Module *, size_t>, set<Module *>> ResolvedDepModulesMap;
-		DenseMap<pair<Module *, Type *>, set<Type *>>ParsedTypeMap;
+		DenseMap<size_t, const FuncSet *> MatchedICallTypeMap;
+		ConcurrentMap<pair<Module *, Type *>, set<Type *>>ParsedTypeMap;
 		DenseMap<GlobalVariable *, set<Type *>>ParsedGlobalTypesMap;
-		DenseMap<pair<Module *, Module *>, set<Type *>>ParsedModuleTypeICallMap;
-		DenseMap<pair<Module *, Module *>, set<Type *>>ParsedModuleTypeDCallMap;
+		// Types already parsed for calls between two modules; flat, so
+		// that the reset at the end of a phase frees no entry
+		DenseSet<pair<pair<Module *, Module *>, Type *>>ParsedModuleTypeICallSet;
+		DenseSet<pair<pair<Module *, Module *>, Type *>>ParsedModuleTypeDCallSet;
 
 
 
@@ -74,9 +135,40 @@ class TyPM : public MLTA {
 		// API for getting dependent modules based on the target type
 		bool resolveFunctionTargets();
 		bool resolveStructTargets();
-		void getDependentModulesTy(size_t TyH, Module *M, set<Module *>&MSet);
-		// API for getting dependent modules based on the target value
-		void getDependentModulesV(Value *TV,	Module *M, set<Module *>&MSet);
+		// ID of M in module sets
+		unsigned moduleID(Module *M) { return Ctx->ModuleIDs.lookup(M); }
+
+		void getDependentModulesTy(TypeFP TyH, Module *M, ModuleSet &MSet);
+
+		// Dependent modules of each module for a type: the closure
+		// over moPropMapAll, computed once per phase by condensing
+		// the propagation graph into SCCs, which share one set
+		struct DepClosure {
+			DenseMap<unsigned, unsigned> SCCOf;
+			vector<ModuleSet> SCCDeps;
+		};
+		// Filled on demand, also by the threads resolving call sites;
+		// a closure does not move once it is added
+		DenseMap<TypeFP, DepClosure *> DepClosureMap;
+		std::mutex DepClosureLock;
+		// Edges of moPropMapAll by type
+		typedef pair<unsigned, const ModuleSet *> PropEdge;
+		DenseMap<TypeFP, ArrayRef<PropEdge>> PropEdgesByType;
+		// Phase arenas of the closures and the edge arrays; both are
+		// released at once when moPropMapAll changes. Closures are
+		// added under DepClosureLock
+		SpecificBumpPtrAllocator<DepClosure> ClosureArena;
+		BumpPtrAllocator EdgeArena;
+		// Drop the closures and index moPropMapAll again; needed
+		// whenever moPropMapAll changes
+		void resetDependenceClosures();
+		const DepClosure &getDependenceClosure(TypeFP TyH);
+		// API for getting dependent modules based on the target value;
+		// diagnostics go to OS
+		void getDependentModulesV(Value *TV,	Module *M, ModuleSet &MSet,
+				raw_ostream &OS = OP);
+		// Stored fields of Ty in M; NULL if none is stored
+		const FieldSet *storedFields(Module *M, Type *Ty);
 
 
 		// Typecasting analysis
@@ -91,18 +183,22 @@ class TyPM : public MLTA {
 		void findTargetTypesInInitializer(GlobalVariable *, Module *, 
 				set<Type *> &TargetTypes);
 		void parseUsesOfGV(GlobalVariable *GV, Value *, 
-				Module *, set<Value *> &Visited);
+				Module *, VisitedSet<Value *> &Visited);
 		bool parseUsesOfValue(Value *V, set<Type *> &ReadTypes, 
 				set<Type *> &WrittenTypes, Module *M);
 		void findTargetTypesInValue(Value *V, 
 				set<Type *> &TargetTypes, Module *M);
-		void parseTargetTypesInCalls(CallInst *CI, Function *CF);
+		void parseTargetTypesInCalls(CallInst *CI, Function *CF,
+				FlowEdges &Flows);
 
 
 		// Maintain the maps
 		// mapping between modules, through calls
-		void addPropagation(Module *ToM, Module *FromM, Type *Ty, 
-				bool isICall = false);
+		void addPropagation(FlowEdges &Flows, Module *ToM, Module *FromM,
+				Type *Ty, bool isICall = false);
+		// Add the edges of ranges of call sites, given in call-site
+		// order, to moPropMap and moPropMapV
+		void mergeFlows(vector<FlowEdges> &Flows);
 		// mapping between module and global, through globals
 		void addModuleToGVType(Type *Ty, Module *M, GlobalVariable *GV);
 		void addGVToModuleType(Type *Ty, GlobalVariable *GV, Module *M);
@@ -114,16 +210,36 @@ class TyPM : public MLTA {
 		void findTargetAllocInFunction(Function * F);
 		void mapDeclToActualFuncs(FuncSet &FS);
 
+		// Swap the fact containers with those of MF
+		void swapModuleFacts(ModuleFacts &MF);
+
 	public:
 
 		// Merged map
-		static DenseMap<pair<Module*, size_t>, set<Module*>>moPropMapAll;
+		static DenseMap<pair<Module*, TypeFP>, ModuleSet>moPropMapAll;
 
 		TyPM(GlobalContext *Ctx_) : MLTA(Ctx_) {
 			LoadTargetTypes(TTySet);
 			LoadOutScopeFuncs(OutScopeFuncNames);
 		}
 
+		// A collector of the facts of M that shares the target types
+		// of Parent; collectors of different modules can run on
+		// different threads
+		TyPM(const TyPM &Parent, Module *M) : MLTA(Parent.Ctx) {
+			TTySet = Parent.TTySet;
+			DLMap[M] = &(M->getDataLayout());
+			IntPtrTy[M] = DLMap[M]->getIntPtrType(M->getContext());
+		}
+
+		// Run the per-module analyses of the initialization with the
+		// fact containers swapped out, so that MF receives only the
+		// facts of M
+		void collectModuleFacts(Module *M, ModuleFacts &MF);
+		// Collect only the facts keyed by IR values, for modules
+		// whose other facts are loaded from a summary
+		void collectIRFacts(Module *M, ModuleFacts &MF);
+
 };
 
 #endif